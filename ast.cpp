@@ -74,4 +74,71 @@ namespace ast {
 	return shared<ast::expr>(app);
   }
   
+
+
+  struct free_variables {
+	using set = std::set<var>;
+	
+	set& out;
+	
+	void operator()(const var& self, const set& bound) const {
+	  if( bound.find(self) == bound.end() ) out.insert(self);
+	}
+	
+	void operator()(const abs& self, const set& bound) const {
+	  set sub = bound;
+	  sub.insert(self.args.begin(), self.args.end());
+	  
+	  self.body->apply(*this, sub);
+	}
+
+	void operator()(const app& self, const set& bound) const {
+	  self.func->apply(*this, bound);
+
+	  for(const auto& e : self.args) {
+		e.apply(*this, bound);
+	  }
+	}
+
+	void operator()(const let& self, const set& bound) const {
+	  set sub = bound;
+	  sub.insert(self.id);
+
+	  // functions are recursive by default
+	  self.value->apply(*this, self.value->is<abs>() ? sub : bound);
+	  self.body->apply(*this, sub);
+	}
+
+	void operator()(const seq& self, const set& bound) const {
+	  set sub = bound;
+	  
+	  for(const auto& t : self.terms) {
+		if( t.is<seq::with>() ) {
+		  auto& with = t.as<seq::with>();
+		  with.def.apply(*this, sub);
+		  sub.insert(with.id);
+		} else {
+		  t.as<expr>().apply(*this, sub);
+		}
+	  }
+	}
+
+	void operator()(const cond& self, const set& bound) const {
+	  self.test->apply(*this, bound);
+	  self.conseq->apply(*this, bound);
+	  self.alt->apply(*this, bound);
+	}
+	
+	template<class T>
+	void operator()(const lit<T>& , const set& ) const { }
+	
+  };
+
+  
+  std::set<var> free(const expr& e) {
+	std::set<var> res;
+	e.apply( free_variables{res}, std::set<var>() );
+	return res;
+  }
+  
 }
@@ -5,6 +5,7 @@
 #include "variant.hpp"
 
 #include <string>
+#include <set>
 
 // syntax tree
 namespace ast {
@@ -159,6 +160,10 @@ namespace ast {
 
   // toplevels
   using node = variant<expr, def, type>;
+
+
+  // free variables in expression
+  std::set<var> free(const expr& e);
   
 }
 
@@ -0,0 +1,149 @@
+#include "lisp.hpp"
+
+namespace lisp {
+
+  // toplevel definitions (def, defn, defmacro and class forms) are indexed
+  // by the names they define instead of being evaluated. the first lookup
+  // of one of these names in their environment evaluates the form, as
+  // does the expansion of a pending macro. typeclass instances are
+  // evaluated along with their class. redefining a variable or macro
+  // evaluates everything still pending first, as it may have been
+  // written against the previous definition.
+  struct autoload_type {
+	environment env;
+	evaluator eval;
+
+	// definition, then forms waiting for it
+	vec<value> forms;
+
+	vec<symbol> names;
+	vec<symbol> macros;
+  };
+
+  using pending_type = std::unordered_map<symbol, ref<autoload_type>>;
+  static pending_type pending, pending_macros;
+
+
+  static void load(const ref<autoload_type>& self) {
+	// forms may look their own names up
+	const auto erase = [&](pending_type& table, symbol s) {
+	  auto it = table.find(s);
+	  if( it != table.end() && it->second == self ) table.erase(it);
+	};
+	
+	for(symbol s : self->names) erase(pending, s);
+	for(symbol s : self->macros) erase(pending_macros, s);
+
+	for(const value& form : self->forms) {
+	  self->eval(self->env, form);
+	}
+  }
+
+
+  // pending definition of name, in env unless null
+  static bool load(pending_type& table, const environment_type* env, symbol name) {
+	auto it = table.find(name);
+	if( it == table.end() ) return false;
+	if( env && it->second->env.get() != env ) return false;
+
+	const ref<autoload_type> self = it->second;
+	load(self);
+
+	return true;
+  }
+
+
+  // heads of definition forms
+  static struct definition_keywords {
+	symbol def, defn, defmacro, class_, instance;
+
+	definition_keywords() {
+	  symbol::intern({{&def, "def"}, {&defn, "defn"}, {&defmacro, "defmacro"},
+					  {&class_, "class"}, {&instance, "instance"}});
+	}
+  } keyword;
+  
+  
+  void autoload(environment& env, const value& form, evaluator eval) {
+	ref<autoload_type> self = shared<autoload_type>();
+	self->env = env;
+	self->eval = eval;
+	self->forms.push_back(form);
+
+	const list x = form.is<list>() ? form.as<list>() : nullptr;
+
+	if( length(x) >= 2 && x->head.is<symbol>() && x->tail->head.is<symbol>() ) {
+	  const symbol head = x->head.as<symbol>();
+	  const symbol name = x->tail->head.as<symbol>();
+
+	  if( head == keyword.def || head == keyword.defn ) {
+		self->names.push_back(name);
+	  } else if( head == keyword.defmacro ) {
+		self->macros.push_back(name);
+	  } else if( head == keyword.class_ && length(x) >= 3 ) {
+		// (class name args (func args...)...)
+		self->names.push_back(name);
+
+		for(const value& f : x->tail->tail->tail) {
+		  if( f.is<list>() && f.as<list>() && f.as<list>()->head.is<symbol>() ) {
+			self->names.push_back( f.as<list>()->head.as<symbol>() );
+		  }
+		}
+	  } else if( head == keyword.instance ) {
+		// (instance class type ...)
+		auto it = pending.find(name);
+		if( it != pending.end() && it->second->env == env ) {
+		  it->second->forms.push_back(form);
+		  return;
+		}
+	  }
+	}
+
+	if( self->names.empty() && self->macros.empty() ) {
+	  eval(env, form);
+	  return;
+	}
+
+	// later definitions override earlier ones
+	for(symbol s : self->names) load(pending, env.get(), s);
+	for(symbol s : self->macros) load(pending_macros, nullptr, s);
+
+	for(symbol s : self->names) pending[s] = self;
+	for(symbol s : self->macros) pending_macros[s] = self;
+  }
+
+
+  bool autoload_macro(symbol name) {
+	return !pending_macros.empty() && load(pending_macros, nullptr, name);
+  }
+
+
+  void autoload_all() {
+	while( !pending.empty() ) {
+	  const ref<autoload_type> self = pending.begin()->second;
+	  load(self);
+	}
+
+	while( !pending_macros.empty() ) {
+	  const ref<autoload_type> self = pending_macros.begin()->second;
+	  load(self);
+	}
+  }
+
+
+  bool environment_type::autoload(symbol name) {
+	return !pending.empty() && load(pending, this, name);
+  }
+
+
+  environment_type::mapped_type& environment_type::operator[](key_type key) {
+	// pending definitions may rely on the value being replaced
+	if( !parent && !pending.empty() && (count(key) || pending.count(key)) ) {
+	  autoload_all();
+	}
+
+	++epoch;
+	return base::operator[](key);
+  }
+
+}
@@ -0,0 +1,4 @@
+# benchmarks (no llvm needed)
+
+TEMPLATE = subdirs
+SUBDIRS = let_chain.pro parse.pro
@@ -0,0 +1,70 @@
+// generalization benchmark: type-check let chains of increasing depth
+//
+//   (fn (z)
+//     (let x0 (fn (y) z)
+//       (let x1 (fn (y) (x0 y))
+//         ...
+//           xn)))
+//
+// with level-based generalization, time per let should stay constant
+// as the chain grows.
+
+#include "../hindley_milner.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+
+
+static ast::expr let_chain(unsigned n) {
+  const ast::var z = "z", y = "y";
+  
+  auto name = [](unsigned i) {
+	std::stringstream ss;
+	ss << "x" << i;
+	return ast::var(ss.str());
+  };
+
+  // innermost body
+  ast::expr res = name(n - 1);
+
+  for(unsigned i = n; i-- > 0; ) {
+	ast::abs value;
+	value.args.push_back(y);
+
+	if( i ) {
+	  value.body = shared<ast::expr>( ast::app{ shared<ast::expr>(name(i - 1)), {y} } );
+	} else {
+	  value.body = shared<ast::expr>(z);
+	}
+	
+	res = ast::let{ name(i), shared<ast::expr>(value), shared<ast::expr>(res) };
+  }
+  
+  return ast::abs{ {z}, shared<ast::expr>(res) };
+}
+
+
+int main(int argc, char** argv) {
+  const unsigned max = argc > 1 ? std::atoi(argv[1]) : 10000;
+
+  using clock = std::chrono::steady_clock;
+  
+  for(unsigned n = max / 8; n <= max; n *= 2) {
+	const ast::expr e = let_chain(n);
+
+	context ctx;
+	union_find<type::mono> types;
+	
+	const auto start = clock::now();
+	const type::poly p = hindley_milner(types, ctx, e);
+	const std::chrono::duration<double> elapsed = clock::now() - start;
+
+	std::cout << "depth: " << n << "\ttime: " << elapsed.count() << "s"
+			  << "\tper let: " << 1e6 * elapsed.count() / n << "us"
+			  << "\t:: " << p << std::endl;
+  }
+  
+  return 0;
+}
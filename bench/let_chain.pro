@@ -0,0 +1,6 @@
+TEMPLATE = app
+TARGET = let_chain
+
+SOURCES = ../common.cpp ../sexpr.cpp \
+		../ast.cpp ../type.cpp ../syntax.cpp ../hindley_milner.cpp \
+		let_chain.cpp
@@ -0,0 +1,41 @@
+#!/bin/sh
+# list pipelines on 1M elements: fused builtins vs the same builtins
+# called through aliases, which are applied one after the other. stage
+# functions only call builtins, so that they are known to be pure
+# usage: bench/lists.sh [path/to/hm] [size]
+
+hm=${1:-./hm}
+size=${2:-1000000}
+
+prelude=$(mktemp) || exit 1
+fused=$(mktemp) || exit 1
+unfused=$(mktemp) || exit 1
+trap 'rm -f "$prelude" "$fused" "$unfused"' EXIT
+
+cat > "$prelude" <<LISP
+(defn range (n acc) (if (= n 0) acc (range (- n 1) (cons n acc))))
+(def x (range $size '()))
+(defn inc (x) (number-add x 1))
+(defn even? (x) (number=? (number-mul 2 (number-div x 2)) x))
+(def map1 list-map)
+(def filter1 list-filter)
+(def fold1 list-fold)
+LISP
+
+cat "$prelude" > "$fused"
+echo "(echo (list-fold (list-filter (list-map x inc) even?) 0 number-add))" >> "$fused"
+
+cat "$prelude" > "$unfused"
+echo "(echo (fold1 (filter1 (map1 x inc) even?) 0 number-add))" >> "$unfused"
+
+# wall time of a session, in ms
+measure() {
+	start=$(date +%s%N)
+	"$@" > /dev/null || exit 1
+	end=$(date +%s%N)
+	echo "$(( (end - start) / 1000 ))" | awk '{ printf "%.2f ms\n", $1 / 1000 }'
+}
+
+printf "range:\t\t"; measure "$hm" --lisp "$prelude"
+printf "unfused:\t"; measure "$hm" --lisp "$unfused"
+printf "fused:\t\t"; measure "$hm" --lisp "$fused"
@@ -0,0 +1,106 @@
+// parser benchmark: boost::spirit reference parser vs hand-written
+// parser, whole program, compact arena or one form at a time, in MB/s
+//
+//   ./parse [file]
+//
+// without a file, a synthetic program of a few MB is generated.
+
+#include "../parse.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+
+
+static std::string synthetic(std::size_t size) {
+  std::stringstream ss;
+
+  for(unsigned i = 0; ss.tellp() < std::streamoff(size); ++i) {
+	ss << "; definition " << i << '\n'
+	   << "(def f" << i << " (fn (x y)\n"
+	   << "  (if (= x " << i << ") \"string literal\"\n"
+	   << "      (f" << i << " (- x 1) '(1.5 true sym-" << i << ")))))\n";
+  }
+  
+  return ss.str();
+}
+
+
+template<class F>
+static void measure(const char* name, std::size_t size, const F& f) {
+  using clock = std::chrono::steady_clock;
+
+  const auto start = clock::now();
+  const std::size_t forms = f();
+  const std::chrono::duration<double> elapsed = clock::now() - start;
+  
+  std::cout << name << ":\t" << forms << " forms\t"
+			<< (size / 1e6) / elapsed.count() << " MB/s" << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+  std::string path;
+  
+  if( argc > 1 ) {
+	path = argv[1];
+  } else {
+	path = "parse_bench.lisp";
+	std::ofstream( path ) << synthetic(8 << 20);
+  }
+
+  std::string buffer;
+  {
+	std::ifstream in(path);
+	std::stringstream ss;
+	ss << in.rdbuf();
+	buffer = ss.str();
+  }
+
+  std::cout << "input: " << path << " (" << buffer.size() / 1e6 << " MB)" << std::endl;
+  
+  measure("spirit", buffer.size(), [&] {
+	  std::stringstream in(buffer);
+	  return parse_spirit(in).size();
+	});
+
+  measure("buffer", buffer.size(), [&] {
+	  return parse(buffer.data(), buffer.data() + buffer.size()).size();
+	});
+
+  measure("mmap", buffer.size(), [&] {
+	  return parse_file(path).size();
+	});
+
+  sexpr::arena storage;
+  measure("arena", buffer.size(), [&] {
+	  return parse(buffer.data(), buffer.data() + buffer.size(), storage).size();
+	});
+  
+  // forms are dropped as soon as they are read
+  const auto count = [](form_reader& forms) {
+	std::size_t res = 0;
+	
+	sexpr::expr e;
+	while( forms.next(e) ) ++res;
+	
+	return res;
+  };
+  
+  measure("stream", buffer.size(), [&] {
+	  std::ifstream in(path);
+	  form_reader forms(in);
+	  return count(forms);
+	});
+
+  measure("mmap stream", buffer.size(), [&] {
+	  form_reader forms = form_reader::file(path);
+	  return count(forms);
+	});
+
+  if( argc == 1 ) std::remove( path.c_str() );
+  
+  return 0;
+}
@@ -0,0 +1,5 @@
+TEMPLATE = app
+TARGET = parse
+
+SOURCES = ../common.cpp ../sexpr.cpp ../parse.cpp \
+		parse.cpp
@@ -0,0 +1,28 @@
+#!/bin/sh
+# lisp startup time: evaluating init.lisp vs loading a heap image
+# usage: bench/startup.sh [path/to/hm] [runs]
+
+hm=${1:-./hm}
+runs=${2:-100}
+
+image=$(mktemp) || exit 1
+empty=$(mktemp) || exit 1
+trap 'rm -f "$image" "$empty"' EXIT
+
+"$hm" --save-image "$image" || exit 1
+
+# average wall time of a session running an empty file, in ms
+measure() {
+	start=$(date +%s%N)
+	i=0
+	while [ $i -lt "$runs" ]; do
+		"$@" "$empty" > /dev/null || exit 1
+		i=$((i + 1))
+	done
+	end=$(date +%s%N)
+	echo "$(( (end - start) / runs / 1000 ))" | awk '{ printf "%.2f ms\n", $1 / 1000 }'
+}
+
+echo "image: $(wc -c < "$image") bytes"
+printf "init.lisp:\t"; measure "$hm" --lisp
+printf "image:\t\t"; measure "$hm" --image "$image"
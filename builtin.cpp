@@ -0,0 +1,1008 @@
+#include "builtin.hpp"
+
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <iostream>
+#include <fstream>
+
+namespace lisp {
+
+  static void argc_check(const char* name, value* first, value* last, unsigned expected) {
+	if( unsigned(last - first) != expected ) {
+	  std::stringstream ss;
+	  ss << name << ": expected " << expected << " arguments, got " << (last - first);
+	  throw error(ss.str());
+	}
+  }
+
+
+  template<class T>
+  static auto cast(const char* name, const value& x) -> decltype( x.as<T>() ) {
+	if( !x.is<T>() ) {
+	  std::stringstream ss;
+	  ss << name << ": unexpected argument " << x;
+	  throw error(ss.str());
+	}
+
+	return x.as<T>();
+  }
+
+  
+  static real to_real(const char* name, const value& x) {
+	if( x.is<integer>() ) return x.as<integer>();
+	return cast<real>(name, x);
+  }
+
+  
+  // arithmetic: integers unless some argument is real. integers wrap
+  // around, as in native code
+  using word = std::make_unsigned<integer>::type;
+  
+  template<template<class> class Op>
+  static value arithmetic(const char* name, value* first, value* last) {
+	argc_check(name, first, last, 2);
+	
+	if( first[0].is<integer>() && first[1].is<integer>() ) {
+	  return integer( Op<word>()(first[0].as<integer>(), first[1].as<integer>()) );
+	}
+
+	return Op<real>()(to_real(name, first[0]), to_real(name, first[1]));
+  }
+
+  
+  static value number_add(environment&, value* first, value* last) {
+	return arithmetic< std::plus >("number-add", first, last);
+  }
+
+  static value number_sub(environment&, value* first, value* last) {
+	return arithmetic< std::minus >("number-sub", first, last);
+  }
+
+  static value number_mul(environment&, value* first, value* last) {
+	return arithmetic< std::multiplies >("number-mul", first, last);
+  }
+
+  static value number_div(environment&, value* first, value* last) {
+	argc_check("number-div", first, last, 2);
+	
+	if( first[0].is<integer>() && first[1].is<integer>() ) {
+	  const integer lhs = first[0].as<integer>(), rhs = first[1].as<integer>();
+	  if( !rhs ) throw error("number-div: division by zero");
+
+	  // the only overflowing quotient
+	  if( rhs == -1 ) return integer( word(0) - word(lhs) );
+	  
+	  return lhs / rhs;
+	}
+	
+	return to_real("number-div", first[0]) / to_real("number-div", first[1]);
+  }
+  
+  static value number_eq(environment&, value* first, value* last) {
+	argc_check("number=?", first, last, 2);
+	
+	if( first[0].is<integer>() && first[1].is<integer>() ) {
+	  return first[0].as<integer>() == first[1].as<integer>();
+	}
+	
+	return to_real("number=?", first[0]) == to_real("number=?", first[1]);
+  }
+
+  static value number_less(environment&, value* first, value* last) {
+	argc_check("number<?", first, last, 2);
+	
+	if( first[0].is<integer>() && first[1].is<integer>() ) {
+	  return first[0].as<integer>() < first[1].as<integer>();
+	}
+	
+	return to_real("number<?", first[0]) < to_real("number<?", first[1]);
+  }
+  
+
+  // lists
+  static value cons_(environment&, value* first, value* last) {
+	argc_check("cons", first, last, 2);
+	return make<cons>(first[0], cast<list>("cons", first[1]));
+  }
+
+  static value car(environment&, value* first, value* last) {
+	argc_check("car", first, last, 1);
+	
+	const list& x = cast<list>("car", first[0]);
+	if( !x ) throw error("car: empty list");
+	
+	return x->head;
+  }
+
+  static value cdr(environment&, value* first, value* last) {
+	argc_check("cdr", first, last, 1);
+	
+	const list& x = cast<list>("cdr", first[0]);
+	if( !x ) throw error("cdr: empty list");
+	
+	return x->tail;
+  }
+
+  static value list_length(environment&, value* first, value* last) {
+	argc_check("list-length", first, last, 1);
+	return integer( length(cast<list>("list-length", first[0])) );
+  }
+
+  static value nth(environment&, value* first, value* last) {
+	argc_check("nth", first, last, 2);
+
+	const list& x = cast<list>("nth", first[0]);
+	const integer n = cast<integer>("nth", first[1]);
+	
+	if( n < 0 || unsigned(n) >= length(x) ) throw error("index out of bounds");
+	
+	return at(x, n);
+  }
+
+  // iterative list functions: results are built in a single block
+  static value list_map(environment& env, value* first, value* last) {
+	argc_check("list-map", first, last, 2);
+
+	vec<value> res;
+	for(value x : cast<list>("list-map", first[0])) {
+	  res.push_back( apply(env, first[1], &x, &x + 1) );
+	}
+
+	return make_list(res.begin(), res.end());
+  }
+
+  static value list_each(environment& env, value* first, value* last) {
+	argc_check("list-each", first, last, 2);
+
+	for(value x : cast<list>("list-each", first[0])) {
+	  apply(env, first[1], &x, &x + 1);
+	}
+
+	return list();
+  }
+
+  // only false is false
+  static bool truthy(const value& x) {
+	return !x.is<boolean>() || x.as<boolean>();
+  }
+  
+  static value list_filter(environment& env, value* first, value* last) {
+	argc_check("list-filter", first, last, 2);
+
+	vec<value> res;
+	for(value x : cast<list>("list-filter", first[0])) {
+	  if( truthy( apply(env, first[1], &x, &x + 1) ) ) res.push_back(x);
+	}
+
+	return make_list(res.begin(), res.end());
+  }
+
+  // (list-fold x init f) computes (f ... (f (f init x0) x1) ...)
+  static value list_fold(environment& env, value* first, value* last) {
+	argc_check("list-fold", first, last, 3);
+
+	value args[2] = { first[1] };
+	for(const value& x : cast<list>("list-fold", first[0])) {
+	  args[1] = x;
+	  args[0] = apply(env, first[2], args, args + 2);
+	}
+
+	return args[0];
+  }
+
+  // rhs is shared
+  static value list_append(environment&, value* first, value* last) {
+	argc_check("list-append", first, last, 2);
+
+	const list& rhs = cast<list>("list-append", first[1]);
+	
+	vec<value> res;
+	for(const value& x : cast<list>("list-append", first[0])) {
+	  res.push_back(x);
+	}
+
+	return make_list(res.begin(), res.end(), rhs);
+  }
+
+  static value list_reverse(environment&, value* first, value* last) {
+	argc_check("list-reverse", first, last, 1);
+
+	vec<value> res;
+	for(const value& x : cast<list>("list-reverse", first[0])) {
+	  res.push_back(x);
+	}
+
+	return make_list(res.rbegin(), res.rend());
+  }
+
+
+  // list pipelines: once expanded, chained calls such as
+  //
+  //   (list-fold (list-filter (list-map x f) p) init g)
+  //
+  // are rewritten as
+  //
+  //   (list-fused x 'map list-map f 'filter list-filter p 'fold list-fold init g)
+  //
+  // which runs all stages on each element in turn, without building
+  // intermediate lists. folds only end pipelines. arguments of all stages
+  // are evaluated before the first one runs, so calls are only rewritten
+  // when later stages take arguments without side effects. as fusion
+  // also changes the order of calls, stages are only interleaved when
+  // their functions are known to have no side effects. otherwise, or when
+  // some stage function is no longer the builtin it was named after,
+  // stages are applied one after the other instead. error messages show
+  // rewritten calls as they were written.
+  namespace fusion {
+
+	struct stage {
+	  symbol kind;
+	  builtin func;
+	  unsigned argc;
+	};
+
+	static const stage stages[] = {
+	  {"map", list_map, 1},
+	  {"filter", list_filter, 1},
+	  {"fold", list_fold, 2},
+	};
+
+	static struct keywords {
+	  symbol fused, quote, cond, begin, fn, lambda;
+
+	  keywords() {
+		symbol::intern({{&fused, "list-fused"}, {&quote, "quote"}, {&cond, "cond"}, {&begin, "do"},
+						{&fn, "fn"}, {&lambda, "lambda"}});
+	  }
+	} keyword;
+
+	static const stage* find_kind(const value& x) {
+	  for(const stage& s : stages) {
+		if( x.is<symbol>() && x.as<symbol>() == s.kind ) return &s;
+	  }
+
+	  return nullptr;
+	}
+
+	// stage for 'kind
+	static const stage* quoted_kind(const value& x) {
+	  if( !x.is<list>() || length(x.as<list>()) != 2 ) return nullptr;
+
+	  const list& self = x.as<list>();
+	  if( !self->head.is<symbol>() || self->head.as<symbol>() != keyword.quote ) return nullptr;
+	  
+	  return find_kind(self->tail->head);
+	}
+	
+	// stage for a call to builtin name with n arguments
+	static const stage* find_call(const value& name, unsigned n) {
+	  const builtin b = name.is<symbol>() ? primitive(name.as<symbol>()) : nullptr;
+
+	  for(const stage& s : stages) {
+		if( b == s.func && n == s.argc + 1 ) return &s;
+	  }
+
+	  return nullptr;
+	}
+
+	
+	// (list-fused source stage...) call, or (list-map source f) and the
+	// like, flattened in res. false when x is not a pipeline producing
+	// a list
+	static bool flatten(const value& x, vec<value>& res) {
+	  if( !x.is<list>() || length(x.as<list>()) < 2 ) return false;
+	  const list& self = x.as<list>();
+	  
+	  if( self->head.is<symbol>() && self->head.as<symbol>() == keyword.fused ) {
+		for(const value& xi : self) res.push_back(xi);
+
+		// stages: quoted kind, function, arguments
+		const stage* s = nullptr;
+		for(std::size_t i = 2; i < res.size(); i += s->argc + 2) {
+		  s = quoted_kind(res[i]);
+		  if( !s || s->func == list_fold ) return false;
+		}
+
+		return true;
+	  }
+
+	  const stage* s = find_call(self->head, length(self) - 1);
+	  if( !s || s->func == list_fold ) return false;
+
+	  res.push_back(keyword.fused);
+	  res.push_back(self->tail->head);
+
+	  const value kind[] = {keyword.quote, s->kind};
+	  res.push_back( make_list(kind, kind + 2) );
+	  res.push_back(self->head);
+
+	  for(const value& xi : self->tail->tail) res.push_back(xi);
+	  return true;
+	}
+
+
+	// expanded argument that can be evaluated early: variables,
+	// constants, quoted data and lambda expressions
+	static bool early(const value& x) {
+	  if( !x.is<list>() || !x.as<list>() ) return true;
+	  const value& head = x.as<list>()->head;
+
+	  return head.is<symbol>() && (head.as<symbol>() == keyword.quote ||
+								   head.as<symbol>() == keyword.fn ||
+								   head.as<symbol>() == keyword.lambda);
+	}
+	
+
+	// (name source args...) with a pipeline as source
+	static value rewrite(const list& call) {
+	  const stage* s = find_call(call->head, length(call) - 1);
+	  if( !s ) return call;
+
+	  for(const value& xi : call->tail->tail) {
+		if( !early(xi) ) return call;
+	  }
+
+	  vec<value> res;
+	  if( !flatten(call->tail->head, res) ) return call;
+
+	  const value kind[] = {keyword.quote, s->kind};
+	  res.push_back( make_list(kind, kind + 2) );
+	  res.push_back(call->head);
+
+	  for(const value& xi : call->tail->tail) res.push_back(xi);
+	  return make_list(res.begin(), res.end());
+	}
+
+
+	// nested calls back from (list-fused source kind func args...)
+	static value source(const list& call) {
+	  vec<value> xs;
+	  for(const value& xi : call) xs.push_back(xi);
+
+	  if( xs.size() < 2 ) return call;
+	  value res = xs[1];
+	  
+	  for(std::size_t i = 2; i < xs.size();) {
+		const stage* s = quoted_kind(xs[i]);
+		if( !s || i + 2 + s->argc > xs.size() ) return call;
+
+		vec<value> sub = {xs[i + 1], res};
+		sub.insert(sub.end(), xs.begin() + i + 2, xs.begin() + i + 2 + s->argc);
+		res = make_list(sub.begin(), sub.end());
+		
+		i += s->argc + 2;
+	  }
+
+	  return res;
+	}
+
+
+	// builtins without side effects
+	static bool pure(builtin b) {
+	  static const symbol names[] = {
+		"number-add", "number-sub", "number-mul", "number-div", "number=?", "number<?",
+		"cons", "car", "cdr", "list-length", "nth", "null?", "list?", "eq?",
+		"to-string", "string-append", "string=?", "symbol-append", "type",
+	  };
+
+	  const char* name = primitive_name(b);
+	  return name && std::find(std::begin(names), std::end(names), symbol(name)) != std::end(names);
+	}
+
+	static bool pure(const value& func, vec<const lambda_type*>& visiting);
+	
+	// resolved lambda body: variables, constants, closures, conditionals
+	// and calls to pure globals. definitions, assignments and anything
+	// else are assumed to have side effects
+	static bool pure(const lambda_type& self, const value& e, vec<const lambda_type*>& visiting) {
+	  if( !e.is<list>() || !e.as<list>() ) return true;
+	  const list& x = e.as<list>();
+
+	  if( x->head.is<symbol>() ) {
+		const symbol s = x->head.as<symbol>();
+		if( s == keyword.quote ) return true;
+		if( s != keyword.cond && s != keyword.begin ) return false;
+
+		for(const value& xi : x->tail) {
+		  if( s == keyword.cond && xi.is<list>() ) {
+			for(const value& c : xi.as<list>()) {
+			  if( !pure(self, c, visiting) ) return false;
+			}
+		  } else if( !pure(self, xi, visiting) ) {
+			return false;
+		  }
+		}
+		
+		return true;
+	  }
+
+	  if( !x->head.is<address>() || x->head.as<address>()->index != address_type::global ) {
+		return false;
+	  }
+
+	  for(const value& xi : x->tail) {
+		if( !pure(self, xi, visiting) ) return false;
+	  }
+
+	  // globals are bound in the root environment
+	  const value* f = self.env->root()->binding(x->head.as<address>()->name);
+	  return f && pure(*f, visiting);
+	}
+
+	// recursive calls are as pure as the rest of the body
+	static bool pure(const value& func, vec<const lambda_type*>& visiting) {
+	  if( func.is<builtin>() ) return pure(func.as<builtin>());
+	  if( !func.is<lambda>() ) return false;
+
+	  const lambda_type* self = func.as<lambda>().get();
+	  if( std::find(visiting.begin(), visiting.end(), self) != visiting.end() ) return true;
+	  if( !self->env ) return false;
+	  
+	  visiting.push_back(self);
+	  const bool res = pure(*self, self->body, visiting);
+	  visiting.pop_back();
+
+	  return res;
+	}
+
+	
+	struct bound {
+	  const stage* self;
+	  value func;
+	  value* args;
+	};
+
+	
+	// stages one after the other
+	static value eager(environment& env, const value& source, const vec<bound>& pipeline) {
+	  value res = source;
+		
+	  for(const bound& b : pipeline) {
+		vec<value> args = { res };
+		args.insert(args.end(), b.args, b.args + b.self->argc);
+		  
+		res = apply(env, b.func, args.data(), args.data() + args.size());
+	  }
+
+	  return res;
+	}
+
+	
+	// all stages on each element in turn
+	static value interleaved(environment& env, const value& source, const vec<bound>& pipeline) {
+	  const bool fold = !pipeline.empty() && pipeline.back().self->func == list_fold;
+	  const std::size_t n = pipeline.size() - fold;
+
+	  vec<value> res;
+	  value acc[2] = { fold ? pipeline.back().args[0] : value() };
+	  
+	  for(const value& x : cast<list>("list-fused", source)) {
+		value y = x;
+		bool keep = true;
+		
+		for(std::size_t i = 0; keep && i < n; ++i) {
+		  const bound& b = pipeline[i];
+		  
+		  if( b.self->func == list_map ) {
+			y = apply(env, b.args[0], &y, &y + 1);
+		  } else {
+			keep = truthy( apply(env, b.args[0], &y, &y + 1) );
+		  }
+		}
+
+		if( !keep ) continue;
+
+		if( fold ) {
+		  acc[1] = std::move(y);
+		  acc[0] = apply(env, pipeline.back().args[1], acc, acc + 2);
+		} else {
+		  res.push_back( std::move(y) );
+		}
+	  }
+
+	  if( fold ) return acc[0];
+	  return make_list(res.begin(), res.end());
+	}
+
+	
+	// (list-fused source kind func args... kind func args...)
+	static value run(environment& env, value* first, value* last) {
+	  if( first == last ) throw error("list-fused: expected source list");
+	  
+	  vec<bound> pipeline;
+	  bool builtins = true;
+	  
+	  for(value* it = first + 1; it != last;) {
+		const stage* s = find_kind(*it);
+		if( !s || unsigned(last - it) < s->argc + 2 ) throw error("list-fused: bad stage");
+		if( !pipeline.empty() && pipeline.back().self->func == list_fold ) {
+		  throw error("list-fused: fold must be the last stage");
+		}
+		
+		pipeline.push_back({s, it[1], it + 2});
+		builtins = builtins && it[1].is<builtin>() && it[1].as<builtin>() == s->func;
+		it += s->argc + 2;
+	  }
+
+	  if( !builtins ) return eager(env, first[0], pipeline);
+
+	  // last stage argument is the function
+	  vec<const lambda_type*> visiting;
+	  for(const bound& b : pipeline) {
+		if( !pure(b.args[b.self->argc - 1], visiting) ) return eager(env, first[0], pipeline);
+	  }
+	  
+	  try {
+		return interleaved(env, first[0], pipeline);
+	  } catch( error& ) {
+		// no side effects: run again to fail as unfused calls would
+		return eager(env, first[0], pipeline);
+	  }
+	}
+	
+  }
+  
+  
+  static value is_null(environment&, value* first, value* last) {
+	argc_check("null?", first, last, 1);
+	return first[0].is<list>() && !first[0].as<list>();
+  }
+
+  static value is_list(environment&, value* first, value* last) {
+	argc_check("list?", first, last, 1);
+	return first[0].is<list>();
+  }
+
+  
+  // identity for reference types except strings
+  static value eq(environment&, value* first, value* last) {
+	argc_check("eq?", first, last, 2);
+
+	if( first[0].is<string>() && first[1].is<string>() ) {
+	  return *first[0].as<string>() == *first[1].as<string>();
+	}
+	
+	return first[0] == first[1];
+  }
+  
+
+  // strings and symbols
+  static std::string to_string(const value& x) {
+	if( x.is<string>() ) return *x.as<string>();
+
+	std::stringstream ss;
+	ss << std::boolalpha << x;
+	return ss.str();
+  }
+  
+  static value to_string(environment&, value* first, value* last) {
+	argc_check("to-string", first, last, 1);
+	return make<string_type>( to_string(first[0]) );
+  }
+  
+  static value string_append(environment&, value* first, value* last) {
+	argc_check("string-append", first, last, 2);
+	return make<string_type>(*cast<string>("string-append", first[0]) +
+								 *cast<string>("string-append", first[1]));
+  }
+
+  static value string_eq(environment&, value* first, value* last) {
+	argc_check("string=?", first, last, 2);
+	return *cast<string>("string=?", first[0]) == *cast<string>("string=?", first[1]);
+  }
+
+  static value symbol_append(environment&, value* first, value* last) {
+	argc_check("symbol-append", first, last, 2);
+	return symbol(std::string(cast<symbol>("symbol-append", first[0]).name()) +
+				  cast<symbol>("symbol-append", first[1]).name());
+  }
+  
+
+  // objects
+  struct type_name {
+	
+	symbol operator()(const boolean&) const { return "bool"; }
+	symbol operator()(const integer&) const { return "int"; }
+	symbol operator()(const real&) const { return "real"; }
+	symbol operator()(const symbol&) const { return "symbol"; }
+	symbol operator()(const string&) const { return "string"; }
+	symbol operator()(const list&) const { return "list"; }
+	symbol operator()(const object& self) const { return self->type; }
+
+	template<class T>
+	symbol operator()(const T&) const { return "function"; }
+	
+	symbol operator()(const environment&) const { return "environment"; }
+  };
+  
+  static value type(environment&, value* first, value* last) {
+	argc_check("type", first, last, 1);
+	return first[0].apply<symbol>(type_name());
+  }
+
+
+  // typeclass dispatch counters
+  static struct {
+	std::size_t hits = 0;			// found in the inline cache
+	std::size_t megamorphic = 0;	// found in the fallback table
+	std::size_t misses = 0;			// looked up in the typeclass
+  } dispatch;
+
+  // typeclass method: dispatch on the type of the first argument
+  struct overload {
+	object tc;
+	symbol name, func;
+
+	// method found in an instance, valid until the instance changes
+	struct entry {
+	  symbol type;
+	  object instance;
+	  std::uint32_t version;
+	  value method;
+	};
+	
+	// polymorphic inline cache on the first argument type, spilling to a
+	// megamorphic table once full. flushed when the typeclass changes
+	struct cache_type {
+	  static const std::size_t size = 4;
+	  
+	  std::uint32_t version = 0;
+	  std::size_t used = 0;
+	  entry entries[size];
+	  std::unordered_map<symbol, entry> table;
+	};
+
+	mutable cache_type cache;
+	
+	overload(const object& tc, symbol name, symbol func)
+	  : tc(tc), name(name), func(func) {
+	  cache.version = tc->version;
+	}
+	
+	// method in typeclass instance
+	entry lookup(symbol type) const {
+	  const value* instance = tc->find(type);
+	  if( !instance || !instance->is<object>() ) {
+		throw error("first argument must be an instance of " + std::string(name.name()));
+	  }
+
+	  const object& self = instance->as<object>();
+	  
+	  const value* res = self->find(func);
+	  if( !res ) {
+		throw error("instance does not implement " + std::string(func.name()));
+	  }
+
+	  return {type, self, self->version, *res};
+	}
+
+	// cached method, looked up again if its instance changed
+	const value& refresh(entry& self, std::size_t& hits) const {
+	  if( self.version == self.instance->version ) {
+		++hits;
+	  } else {
+		++dispatch.misses;
+		self = lookup(self.type);
+	  }
+
+	  return self.method;
+	}
+	
+	const value& resolve(symbol type) const {
+	  if( cache.version != tc->version ) {
+		cache = cache_type();
+		cache.version = tc->version;
+	  }
+	  
+	  for(std::size_t i = 0; i < cache.used; ++i) {
+		if( cache.entries[i].type == type ) {
+		  return refresh(cache.entries[i], dispatch.hits);
+		}
+	  }
+
+	  if( cache.used == cache_type::size ) {
+		auto it = cache.table.find(type);
+		if( it != cache.table.end() ) {
+		  return refresh(it->second, dispatch.megamorphic);
+		}
+	  }
+
+	  ++dispatch.misses;
+	  entry res = lookup(type);
+	  
+	  if( cache.used < cache_type::size ) {
+		cache.entries[cache.used] = std::move(res);
+		return cache.entries[cache.used++].method;
+	  }
+	  
+	  return cache.table.emplace(type, std::move(res)).first->second.method;
+	}
+	
+
+	value operator()(environment& env, value* first, value* last) const {
+	  if( first == last ) {
+		throw error("first argument must be an instance of " + std::string(name.name()));
+	  }
+
+	  // the cache may be flushed during the call
+	  const value method = resolve( first[0].apply<symbol>(type_name()) );
+	  return apply(env, method, first, last);
+	}
+  };
+  
+  // (make-overload typeclass name func)
+  static value make_overload(environment&, value* first, value* last) {
+	argc_check("make-overload", first, last, 3);
+	
+	closure res = make<closure_type>( overload{ cast<object>("make-overload", first[0]),
+												cast<symbol>("make-overload", first[1]),
+												cast<symbol>("make-overload", first[2]) });
+
+	const value source[] = {make_overload, first[0], first[1], first[2]};
+	res->source = make_list(source, source + 4);
+	
+	return res;
+  }
+
+  static value make_object(environment&, value* first, value* last) {
+	argc_check("object", first, last, 1);
+	return make<object_type>( cast<symbol>("object", first[0]) );
+  }
+
+  // (object-attr obj name [error-message])
+  static value object_attr(environment&, value* first, value* last) {
+	if( last - first != 3 ) argc_check("object-attr", first, last, 2);
+
+	const object& self = cast<object>("object-attr", first[0]);
+	const symbol& name = cast<symbol>("object-attr", first[1]);
+	
+	const value* res = self->find(name);
+	if( !res ) {
+	  if( last - first == 3 ) throw error(to_string(first[2]));
+	  throw error("object-attr: unknown attribute " + std::string(name.name()));
+	}
+
+	return *res;
+  }
+
+  static value object_make_attr(environment&, value* first, value* last) {
+	argc_check("object-make-attr!", first, last, 3);
+
+	const object& self = cast<object>("object-make-attr!", first[0]);
+	self->set( cast<symbol>("object-make-attr!", first[1]), first[2] );
+	
+	return null;
+  }
+
+  
+  // misc
+  static value echo(environment&, value* first, value* last) {
+	bool sep = false;
+	for(value* it = first; it != last; ++it) {
+	  if( sep ) std::cout << ' ';
+	  std::cout << to_string(*it);
+	  sep = true;
+	}
+	std::cout << std::endl;
+	
+	return null;
+  }
+
+  static value error_(environment&, value* first, value* last) {
+	argc_check("error", first, last, 1);
+	throw error(to_string(first[0]));
+  }
+  
+  // (apply f args)
+  static value apply_(environment& env, value* first, value* last) {
+	argc_check("apply", first, last, 2);
+
+	vec<value> args;
+	for(const value& x : cast<list>("apply", first[1]) ) {
+	  args.push_back(x);
+	}
+	
+	return apply(env, first[0], args.data(), args.data() + args.size());
+  }
+
+
+  // ((expanded n) (avoided n))
+  static value macro_stats_(environment&, value* first, value* last) {
+	argc_check("macro-stats", first, last, 0);
+
+	const auto entry = [](const char* name, std::size_t n) -> value {
+	  const value pair[] = { symbol(name), integer(n) };
+	  return make_list(pair, pair + 2);
+	};
+	
+	const expansion_stats& stats = macro_stats();
+	const value res[] = { entry("expanded", stats.expanded), entry("avoided", stats.avoided) };
+	
+	return make_list(res, res + 2);
+  }
+
+
+  // ((frames n) (stack n))
+  static value frame_stats_(environment&, value* first, value* last) {
+	argc_check("frame-stats", first, last, 0);
+
+	const auto entry = [](const char* name, std::size_t n) -> value {
+	  const value pair[] = { symbol(name), integer(n) };
+	  return make_list(pair, pair + 2);
+	};
+	
+	const call_stats& stats = frame_stats();
+	const value res[] = { entry("frames", stats.frames), entry("stack", stats.stack) };
+	
+	return make_list(res, res + 2);
+  }
+
+  
+  // ((hits n) (megamorphic n) (misses n))
+  static value dispatch_stats(environment&, value* first, value* last) {
+	argc_check("dispatch-stats", first, last, 0);
+
+	const auto entry = [](const char* name, std::size_t n) -> value {
+	  const value pair[] = { symbol(name), integer(n) };
+	  return make_list(pair, pair + 2);
+	};
+	
+	const value res[] = { entry("hits", dispatch.hits),
+						  entry("megamorphic", dispatch.megamorphic),
+						  entry("misses", dispatch.misses) };
+	
+	return make_list(res, res + 3);
+  }
+
+
+  // (profile-start [sampling interval in ms])
+  static value profile_start(environment&, value* first, value* last) {
+	if( first == last ) {
+	  profile::start();
+	  return null;
+	}
+	
+	argc_check("profile-start", first, last, 1);
+	profile::start( to_real("profile-start", first[0]) );
+	
+	return null;
+  }
+
+  
+  // (profile-stop [collapsed stacks file]) returns a list of
+  // (name calls inclusive-ms exclusive-ms samples)
+  static value profile_stop(environment&, value* first, value* last) {
+	if( first != last ) argc_check("profile-stop", first, last, 1);
+	
+	profile::stop();
+
+	if( first != last ) {
+	  const std::string& filename = *cast<string>("profile-stop", first[0]);
+	  std::ofstream out(filename);
+	  if( !out ) throw error("profile-stop: cannot open " + filename);
+	  
+	  profile::collapsed(out);
+	}
+
+	vec<value> res;
+	for(const profile::entry& e : profile::report()) {
+	  const value row[] = { e.name, integer(e.calls), real(e.inclusive),
+							real(e.exclusive), integer(e.samples) };
+	  res.push_back( make_list(row, row + 5) );
+	}
+	
+	return make_list(res.begin(), res.end());
+  }
+  
+
+  static value gc_(environment&, value* first, value* last) {
+	argc_check("gc", first, last, 0);
+	return integer(gc::collect(true));
+  }
+  
+
+  static value gc_stats(environment&, value* first, value* last) {
+	argc_check("gc-stats", first, last, 0);
+
+	const auto entry = [](const char* name, value x) -> value {
+	  const value pair[] = { symbol(name), x };
+	  return make_list(pair, pair + 2);
+	};
+
+	const gc::stats_type& stats = gc::stats();
+	const value res[] = {
+	  entry("young", integer(stats.young)),
+	  entry("full", integer(stats.full)),
+	  entry("collected", integer(stats.collected)),
+	  entry("pause", real(stats.pause)),
+	  entry("max-pause", real(stats.max_pause)),
+	  entry("live", integer(stats.live)),
+	  entry("tracked", integer(stats.tracked)),
+	};
+	
+	return make_list(res, res + 7);
+  }
+  
+  
+  static const std::pair<const char*, builtin> table[] = {
+	{"number-add", number_add},
+	{"number-sub", number_sub},
+	{"number-mul", number_mul},
+	{"number-div", number_div},
+	{"number=?", number_eq},
+	{"number<?", number_less},
+	{"cons", cons_},
+	{"car", car},
+	{"cdr", cdr},
+	{"list-length", list_length},
+	{"nth", nth},
+	{"list-map", list_map},
+	{"list-each", list_each},
+	{"list-filter", list_filter},
+	{"list-fold", list_fold},
+	{"list-append", list_append},
+	{"list-reverse", list_reverse},
+	{"list-fused", fusion::run},
+	{"null?", is_null},
+	{"list?", is_list},
+	{"eq?", eq},
+	{"to-string", to_string},
+	{"string-append", string_append},
+	{"string=?", string_eq},
+	{"symbol-append", symbol_append},
+	{"type", type},
+	{"object", make_object},
+	{"object-attr", object_attr},
+	{"object-make-attr!", object_make_attr},
+	{"make-overload", make_overload},
+	{"echo", echo},
+	{"error", error_},
+	{"apply", apply_},
+	{"macro-stats", macro_stats_},
+	{"frame-stats", frame_stats_},
+	{"dispatch-stats", dispatch_stats},
+	{"profile-start", profile_start},
+	{"profile-stop", profile_stop},
+	{"gc", gc_},
+	{"gc-stats", gc_stats},
+  };
+
+  
+  void builtins(environment& env) {
+	for(const auto& it : table) {
+	  (*env)[ it.first ] = it.second;
+	}
+
+	rewrites();
+  }
+
+
+  void rewrites() {
+	for(const fusion::stage& s : fusion::stages) {
+	  define_rewrite(primitive_name(s.func), fusion::rewrite);
+	}
+
+	define_source(fusion::keyword.fused, fusion::source);
+  }
+
+
+  builtin primitive(symbol name) {
+	for(const auto& it : table) {
+	  if( name == it.first ) return it.second;
+	}
+	
+	return nullptr;
+  }
+
+
+  const char* primitive_name(builtin func) {
+	for(const auto& it : table) {
+	  if( func == it.second ) return it.first;
+	}
+	
+	return nullptr;
+  }
+  
+}
@@ -0,0 +1,22 @@
+#ifndef BUILTIN_HPP
+#define BUILTIN_HPP
+
+#include "lisp.hpp"
+
+namespace lisp {
+
+  // define builtin functions in env, along with their rewrites
+  void builtins(environment& env);
+
+  // define expansion-time rewrites of builtin calls
+  void rewrites();
+
+  // builtin function registered as name, if any
+  builtin primitive(symbol name);
+
+  // name a builtin function is registered as, nullptr if none
+  const char* primitive_name(builtin func);
+  
+}
+
+#endif
@@ -1,22 +1,200 @@
 #include "common.hpp"
 
-#include <set>
 #include <ostream>
-#include <functional>
-#include <string>
+#include <atomic>
+#include <cstring>
+#include <cstdlib>
+#include <cstddef>
+#include <algorithm>
 
-static std::set<std::string> table;
 
-symbol::symbol(const std::string& s) : string(  table.insert(s).first->c_str() ) { }
-symbol::symbol(const char* s) : string(  table.insert(s).first->c_str() ) { }
+namespace {
 
-std::ostream& operator << (std::ostream& out, const symbol& self) {
-  return out << self.name();
+  // interned string, allocated in a per-thread arena
+  struct node {
+	std::size_t hash;
+	std::size_t size;
+	char data[1];
+  };
+
+
+  // chunked bump allocation, never freed
+  struct arena_type {
+	char* ptr;
+	char* end;
+
+	static const std::size_t chunk_size = 1 << 16;
+	
+	void* allocate(std::size_t size) {
+	  size = (size + alignof(node) - 1) & ~(alignof(node) - 1);
+	  
+	  if( std::size_t(end - ptr) < size ) {
+		const std::size_t n = size > chunk_size ? size : chunk_size;
+		ptr = static_cast<char*>( std::malloc(n) );
+		if( !ptr ) throw std::bad_alloc();
+		end = ptr + n;
+	  }
+
+	  void* res = ptr;
+	  ptr += size;
+	  return res;
+	}
+
+	// give back last allocation
+	void release(void* last) {
+	  ptr = static_cast<char*>(last);
+	}
+	
+  };
+
+  static thread_local arena_type arena;
+
+  
+  // fnv-1a
+  static std::size_t hash(const char* data, std::size_t size) {
+	std::size_t res = 14695981039346656037ull;
+	for(std::size_t i = 0; i < size; ++i) {
+	  res ^= static_cast<unsigned char>(data[i]);
+	  res *= 1099511628211ull;
+	}
+	return res;
+  }
+
+  
+  // open-addressing tables of interned nodes. slots are only ever filled,
+  // with a compare-and-swap, so lookups are plain acquire loads. past half
+  // load a table gets a successor twice as large: its nodes are copied
+  // over and its empty slots are marked as moved, which sends later
+  // insertions to the successor. tables are never freed. the first one is
+  // constant-initialized static storage, so that symbols can be created
+  // during static initialization of other translation units.
+  struct table_type {
+	std::atomic<const node*>* slots;
+	const std::size_t size;
+	std::atomic<std::size_t> count;
+	std::atomic<table_type*> next;
+
+	constexpr table_type(std::atomic<const node*>* slots, std::size_t size)
+	  : slots(slots), size(size), count(0), next(nullptr) { }
+  };
+
+  static const node moved = {0, 0, {0}};
+
+  static const std::size_t initial_size = 1 << 12;
+  static std::atomic<const node*> initial_slots[initial_size];
+  static table_type initial(initial_slots, initial_size);
+
+  // oldest table still worth looking into
+  static std::atomic<table_type*> current(&initial);
+
+  
+  // put x in the first empty slot for its hash, in self or its successors
+  static void place(table_type* self, const node* x) {
+	const std::size_t mask = self->size - 1;
+	
+	for(std::size_t i = x->hash & mask; ; i = (i + 1) & mask) {
+	  const node* expected = nullptr;
+	  if( self->slots[i].compare_exchange_strong(expected, x, std::memory_order_release,
+												 std::memory_order_acquire) ) {
+		self->count.fetch_add(1, std::memory_order_relaxed);
+		return;
+	  }
+	  
+	  if( expected == &moved ) return place(self->next.load(std::memory_order_acquire), x);
+	}
+  }
+
+
+  // give self a successor and move its nodes there, unless some other
+  // thread does it
+  static void grow(table_type* self) {
+	const std::size_t size = 2 * self->size;
+	table_type* next = new table_type(new std::atomic<const node*>[size](), size);
+
+	table_type* expected = nullptr;
+	if( !self->next.compare_exchange_strong(expected, next, std::memory_order_acq_rel) ) {
+	  delete [] next->slots;
+	  delete next;
+	  return;
+	}
+
+	for(std::size_t i = 0; i < self->size; ++i) {
+	  const node* x = nullptr;
+	  if( self->slots[i].compare_exchange_strong(x, &moved, std::memory_order_acq_rel) ) continue;
+	  if( x != &moved ) place(next, x);
+	}
+
+	expected = self;
+	current.compare_exchange_strong(expected, next, std::memory_order_release);
+  }
+
+  
+  static const char* intern(const char* data, std::size_t size) {
+	const std::size_t h = hash(data, size);
+	node* self = nullptr;
+
+	const auto equal = [&](const node* x) {
+	  return x->hash == h && x->size == size && !std::memcmp(x->data, data, size);
+	};
+	
+	for(table_type* table = current.load(std::memory_order_acquire); ;
+		table = table->next.load(std::memory_order_acquire)) {
+
+	  if( !table->next.load(std::memory_order_acquire) &&
+		  2 * table->count.load(std::memory_order_relaxed) > table->size ) {
+		grow(table);
+	  }
+
+	  // no insertions in a table being moved
+	  const bool moving = table->next.load(std::memory_order_acquire);
+	  const std::size_t mask = table->size - 1;
+	  
+	  for(std::size_t i = h & mask; ; i = (i + 1) & mask) {
+		const node* x = table->slots[i].load(std::memory_order_acquire);
+
+		if( !x ) {
+		  if( !moving && !self ) {
+			self = static_cast<node*>( arena.allocate(offsetof(node, data) + size + 1) );
+			self->hash = h;
+			self->size = size;
+			std::memcpy(self->data, data, size);
+			self->data[size] = 0;
+		  }
+
+		  if( table->slots[i].compare_exchange_strong(x, moving ? &moved : self,
+													  std::memory_order_acq_rel) ) {
+			if( moving ) break;
+			
+			table->count.fetch_add(1, std::memory_order_relaxed);
+			return self->data;
+		  }
+		}
+
+		if( x == &moved ) break;
+		
+		if( equal(x) ) {
+		  // give back our allocation
+		  if( self ) arena.release(self);
+		  return x->data;
+		}
+	  }
+	}
+  }
+  
+}
+
+
+symbol::symbol(const std::string& s) : string( ::intern(s.data(), s.size()) ) { }
+symbol::symbol(const char* s) : string( ::intern(s, std::strlen(s)) ) { }
+symbol::symbol(const char* data, std::size_t size) : string( ::intern(data, size) ) { }
+
+void symbol::intern(std::initializer_list< std::pair<symbol*, const char*> > table) {
+  for(const auto& it : table) {
+	it.first->string = ::intern(it.second, std::strlen(it.second));
+  }
 }
 
 
-// namespace std {
-//   std::size_t hash< symbol >::operator()(const symbol& s) const {
-// 	return std::hash<const char*>{}(s.name());
-//   }
-// }
+std::ostream& operator << (std::ostream& out, const symbol& self) {
+  return out << self.name();
+}
@@ -3,7 +3,13 @@
 
 #include <memory>
 #include <vector>
+#include <string>
+#include <initializer_list>
+#include <utility>
 
+// interned strings: equal symbols share the same (immutable) storage,
+// so comparison/hashing is pointer identity. interning is thread-safe
+// and lock-free.
 class symbol {
   const char* string = nullptr;
 public:
@@ -13,6 +19,18 @@ public:
   symbol() { }
   symbol(const std::string& );
   symbol(const char* );
+  symbol(const char* data, std::size_t size);
+
+  // intern a table of names (e.g. keywords) in one go, so that they are
+  // stored together: each symbol is set to its name
+  static void intern(std::initializer_list< std::pair<symbol*, const char*> > table);
+
+  // symbol for an already interned name
+  static symbol interned(const char* name) {
+	symbol res;
+	res.string = name;
+	return res;
+  }
 
   inline bool operator<(const symbol& other) const { return string < other.string; }
   inline bool operator==(const symbol& other) const { return string == other.string; }
@@ -32,17 +50,20 @@ static inline ref<T> shared(Args&& ... x) {
 template<class T>
 using vec = std::vector<T>;
 
-// namespace std {
+namespace std {
 
-//   template<class T>
-//   struct hash;
+  template<class T>
+  struct hash;
   
-//   template<>
-//   struct hash< ::symbol > {
+  template<>
+  struct hash< ::symbol > {
 
-// 	std::size_t operator()(const symbol& s) const;
+	std::size_t operator()(const symbol& s) const {
+	  // interned storage is at least 8-byte aligned
+	  return reinterpret_cast<std::size_t>(s.name()) >> 3;
+	}
 	
-//   };
-// }
+  };
+}
 
 #endif
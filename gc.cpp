@@ -0,0 +1,230 @@
+#include "lisp.hpp"
+
+#include <chrono>
+#include <algorithm>
+
+namespace lisp {
+
+  // reference counting frees everything but cycles (closures and their
+  // defining frames, mutually recursive definitions, etc). the collector
+  // finds cycles by trial deletion: objects that may hold references
+  // (lists, lambdas, environments, objects, closures) are tracked in two
+  // generations, and a collection subtracts references internal to the
+  // generation from reference counts. what remains are references from
+  // the outside (c++ locals, older objects, leaves), so objects not
+  // reachable from a positive count are garbage. young survivors are
+  // promoted, and the old generation is collected when it has grown
+  // enough since the last full collection.
+  class collector {
+
+	struct entry {
+	  header* obj;
+	  tag type;
+	};
+
+	using generation = vec<entry>;
+	generation young, old;
+
+	// scratch counts and marks, indexed by header::index
+	vec<std::int64_t> refs;
+	vec<entry> work;
+
+	bool running = false;
+	std::size_t last_full = 0;
+
+	static constexpr std::size_t young_limit = 10000;
+
+	static bool container(tag type) {
+	  switch(type) {
+	  case list_tag:
+	  case lambda_tag:
+	  case environment_tag:
+	  case object_tag:
+	  case closure_tag:
+		return true;
+	  default:
+		return false;
+	  }
+	}
+
+	template<class F>
+	static void trace(const entry& e, F&& f) {
+	  switch(e.type) {
+	  case list_tag: static_cast<cons*>(e.obj)->trace(f); break;
+	  case lambda_tag: static_cast<lambda_type*>(e.obj)->trace(f); break;
+	  case environment_tag: static_cast<environment_type*>(e.obj)->trace(f); break;
+	  case object_tag: static_cast<object_type*>(e.obj)->trace(f); break;
+	  case closure_tag: static_cast<closure_type*>(e.obj)->trace(f); break;
+	  default: break;
+	  }
+	}
+
+	// tracked child in the generation being collected
+	static bool member(const value& x, bool full, entry& e) {
+	  if( !x.heap() ) return false;
+
+	  e.type = tag(x.bits >> 48);
+	  e.obj = x.counted();
+
+	  return container(e.type) && e.obj->old == full;
+	}
+
+	// release without changing the type of handles
+	static void clear(value& x) {
+	  if( !x.heap() ) return;
+
+	  value tmp;
+	  tmp.bits = x.bits;
+	  x.bits = value::box(tag(x.bits >> 48), 0);
+	}
+
+	static void insert(generation& gen, const entry& e, bool is_old) {
+	  e.obj->index = gen.size();
+	  e.obj->old = is_old;
+	  gen.push_back(e);
+	}
+
+  public:
+	gc::stats_type stats;
+
+	void track(header* obj, tag type, std::size_t size) {
+	  stats.live += size;
+	  if( !container(type) ) return;
+
+	  insert(young, {obj, type}, false);
+	  ++stats.tracked;
+
+	  if( young.size() >= young_limit && !running ) {
+		collect( old.size() > last_full + last_full / 2 + young_limit );
+	  }
+	}
+
+	void untrack(header* obj, tag type, std::size_t size) {
+	  stats.live -= size;
+	  if( !container(type) ) return;
+
+	  // swap-remove
+	  generation& gen = obj->old ? old : young;
+	  assert( gen[obj->index].obj == obj );
+
+	  gen[obj->index] = gen.back();
+	  gen[obj->index].obj->index = obj->index;
+	  gen.pop_back();
+
+	  --stats.tracked;
+	}
+
+
+	std::size_t collect(bool full) {
+	  if( running ) return 0;
+	  running = true;
+
+	  const auto start = std::chrono::steady_clock::now();
+
+	  // collect young and old together
+	  if( full ) {
+		for(const entry& e : young) insert(old, e, true);
+		young.clear();
+	  }
+
+	  generation& gen = full ? old : young;
+	  const std::size_t n = gen.size();
+	  entry child;
+
+	  // count references from outside the generation
+	  refs.resize(n);
+	  for(std::size_t i = 0; i < n; ++i) {
+		refs[i] = gen[i].obj->refs;
+	  }
+
+	  for(const entry& e : gen) {
+		trace(e, [&](value& x) {
+			if( member(x, full, child) ) --refs[child.obj->index];
+		  });
+	  }
+
+	  // mark everything reachable from the outside (marks are -1)
+	  work.clear();
+	  for(std::size_t i = 0; i < n; ++i) {
+		if( refs[i] > 0 ) work.push_back(gen[i]);
+	  }
+
+	  while( !work.empty() ) {
+		const entry e = work.back();
+		work.pop_back();
+		refs[e.obj->index] = -1;
+
+		trace(e, [&](value& x) {
+			if( member(x, full, child) && refs[child.obj->index] >= 0 ) {
+			  refs[child.obj->index] = -1;
+			  work.push_back(child);
+			}
+		  });
+	  }
+
+	  // split survivors and garbage
+	  generation garbage;
+	  generation survivors;
+
+	  for(std::size_t i = 0; i < n; ++i) {
+		(refs[i] < 0 ? survivors : garbage).push_back(gen[i]);
+	  }
+
+	  young.clear();
+	  if( full ) old.clear();
+
+	  for(const entry& e : survivors) insert(old, e, true);
+
+	  // garbage stays tracked in the young generation until freed
+	  for(const entry& e : garbage) insert(young, e, false);
+
+	  // break cycles while holding garbage, then free it
+	  for(const entry& e : garbage) ++e.obj->refs;
+	  for(const entry& e : garbage) trace(e, clear);
+	  for(const entry& e : garbage) {
+		if( --e.obj->refs == 0 ) value::destroy(value::box(e.type, reinterpret_cast<std::uint64_t>(e.obj)));
+	  }
+
+	  if( full ) last_full = old.size();
+
+	  const std::chrono::duration<double, std::milli> pause = std::chrono::steady_clock::now() - start;
+
+	  ++(full ? stats.full : stats.young);
+	  stats.collected += garbage.size();
+	  stats.pause += pause.count();
+	  stats.max_pause = std::max(stats.max_pause, pause.count());
+
+	  running = false;
+	  return garbage.size();
+	}
+
+  };
+
+
+  namespace gc {
+
+	// never destroyed, as static values may be released at exit
+	static collector& instance() {
+	  static collector* res = new collector;
+	  return *res;
+	}
+
+	void track(header* obj, tag type, std::size_t size) {
+	  instance().track(obj, type, size);
+	}
+
+	void untrack(header* obj, tag type, std::size_t size) {
+	  instance().untrack(obj, type, size);
+	}
+
+	std::size_t collect(bool full) {
+	  return instance().collect(full);
+	}
+
+	const stats_type& stats() {
+	  return instance().stats;
+	}
+
+  }
+
+}
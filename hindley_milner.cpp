@@ -68,10 +68,11 @@ const type::poly& context::find(const ast::var& var) const {
 context& context::set(const ast::var& var, const type::poly& p) {
   // TODO cache last insertion to get amortized O(1)
   
-  auto it = table.insert( table.end(), std::make_pair(var, p) );
-
-  // insertion failed
-  if(it->first != var) {
+  auto res = table.insert( std::make_pair(var, p) );
+  auto it = res.first;
+  
+  // insertion failed: redefinition
+  if( !res.second ) {
 
 	// TODO are we super sure this is sufficient ?
 	if( it->second.is<type::scheme>() ) {
@@ -179,28 +180,32 @@ static std::set<type::var>&& dangerous(const type::mono& t, std::set<type::var>&
 static void unify(union_find<type::mono>& types, type::mono a, type::mono b);
 
 
-// true if monotype @self contains type variable @var
-struct contains {
-
-  bool operator()(const type::app& self, const type::var& var) const {
-
-	for(const auto& t : self->args) {
-	  if(t == var) return true;
-	}
-
-	return false;
-  };
+// true if monotype @t contains type variable @self (occurs check). the
+// levels of variables in @t are lowered to the level of @self on the
+// way, since @t becomes reachable from wherever @self is.
+static bool occurs(union_find<type::mono>& types, const type::var& self, const type::mono& t) {
+  using namespace type;
 
+  const type::mono r = types.find(t);
+  
+  if( r.is<var>() ) {
+	const var& v = r.as<var>();
+	if( v == self ) return true;
 
-  bool operator()(const type::lit& , const type::var& ) const {
+	const unsigned lvl = types.level(self);
+	if( lvl < types.level(v) ) types.set_level(v, lvl);
+	
 	return false;
-  };
+  }
 
-  bool operator()(const type::var& self, const type::var& var) const {
-	return self == var;
-  };
+  if( r.is<app>() ) {
+	for(const auto& ti : r.as<app>()->args) {
+	  if( occurs(types, self, ti) ) return true;
+	}
+  }
   
-};
+  return false;
+}
 
 
 struct unification_error : type_error {
@@ -276,7 +281,7 @@ static void unify(union_find<type::mono>& types, type::mono a, type::mono b) {
 	auto& other = a.is<var>() ? b : a;
 
 	// avoid recursive unification (e.g. 'a with 'a -> 'b)
-	if(other.is<app>() && other.apply<bool>(contains(), self)) {
+	if(other.is<app>() && occurs(types, self, other)) {
 	  throw unification_error(other, self);
 	};
 	
@@ -303,6 +308,8 @@ using substitution = std::map<type::var, type::var>;
 // instantiate a polytype with fresh type variables
 struct instantiate {
 
+  union_find<type::mono>& types;
+
   // sub-dispatch for monotypes
   struct monotype {
 
@@ -325,7 +332,7 @@ struct instantiate {
 		args.push_back( t.apply<type::mono>(*this, substitution(s)) );
 	  }
 	  
-	  return std::make_shared<type::app_type>(self->func, args);
+	  return type::app(self->func, args);
 	}
 	
 	type::mono operator()(const type::lit& self, substitution&& ) const {
@@ -346,8 +353,7 @@ struct instantiate {
 
 	// add substitutions
 	for(const auto& v : self.args) {
-	  type::var fresh;
-	  s[v] = fresh;
+	  s[v] = types.fresh();
 	};
 
 	// instantiate body given new substitutions
@@ -391,7 +397,7 @@ static type::mono represent(union_find<type::mono>& types,
 					 return represent(types, t);
 				   });
 	
-	res = std::make_shared<type::app_type>(self->func, args);
+	res = type::app(self->func, args);
   }
 
   return res;  
@@ -440,6 +446,67 @@ type::poly generalize(const context& ctx, const type::mono& t, const std::set<ty
 }
 
 
+// collect variables in (represented) monotype @t deeper than the
+// current let-depth, and move @exclude variables to the current depth
+static void generalizable(union_find<type::mono>& types, const type::mono& t,
+						  const std::set<type::var>& exclude, vec<type::var>& out) {
+  using namespace type;
+  
+  if( t.is<var>() ) {
+	const var& v = t.as<var>();
+	if( types.level(v) <= types.depth ) return;
+	
+	if( exclude.find(v) != exclude.end() ) {
+	  types.set_level(v, types.depth);
+	} else {
+	  out.push_back(v);
+	}
+	
+  } else if( t.is<app>() ) {
+	for(const auto& ti : t.as<app>()->args) {
+	  generalizable(types, ti, exclude, out);
+	}
+  }
+}
+
+
+type::poly generalize(union_find<type::mono>& types, const type::mono& t, const std::set<type::var>& exclude) {
+  using namespace type;
+
+  scheme res;
+  generalizable(types, t, exclude, res.args);
+  
+  if( res.args.empty() ) {
+	return t;
+  }
+
+  std::sort(res.args.begin(), res.args.end());
+  res.args.erase( std::unique(res.args.begin(), res.args.end()), res.args.end());
+  
+  res.body = t;
+  return res;
+}
+
+
+// let-depth scope for generalization
+struct level_raii {
+  union_find<type::mono>& types;
+
+  level_raii(union_find<type::mono>& types) : types(types) { ++types.depth; }
+  ~level_raii() { --types.depth; }
+};
+
+
+bool closed(const type::poly& p) {
+  if( p.is<type::mono>() ) return variables(p.as<type::mono>()).empty();
+
+  auto& self = p.as<type::scheme>();
+  const std::set<type::var> bound(self.args.begin(), self.args.end());
+  
+  return (variables(self.body) - bound).empty();
+}
+
+
 struct debug_raii {
   const char* const id;
 
@@ -476,7 +543,7 @@ struct algorithm_w {
 	type::mono res;
 	if( p.is<type::scheme>() ) {
 	  // instantiate type scheme with fresh variables
-	  res = p.apply<type::mono>(instantiate());
+	  res = p.apply<type::mono>(instantiate{types});
 	} else {
 
 	  // this happens with value restriction
@@ -497,7 +564,7 @@ struct algorithm_w {
 	type::mono func = self.func->apply<type::mono>(*this, c);
 
 	// fresh result type
-	type::var result;
+	type::var result = types.fresh();
 
 	// function type for application: a0 -> (a1 -> (... -> (an -> result)))
 	type::mono app = result;
@@ -539,7 +606,7 @@ struct algorithm_w {
 	} else {
 	  
 	  // fresh type variable for argument type
-	  from = type::var();
+	  from = types.fresh();
 	  
 	  // add assumption to the context
 	  sub.set(*first, from);
@@ -577,17 +644,21 @@ struct algorithm_w {
 	// functions are recursive by default
 	if(value->is<ast::abs>()) { value = self.rec(); }
 	
-	// infer type for definition
-	type::mono def = value->apply<type::mono>(*this, c);
-
+	// infer type for definition one level deeper
+	type::mono def;
+	{
+	  level_raii level(types);
+	  def = value->apply<type::mono>(*this, c);
+	}
+	
 	// enriched context with local definition
 	context sub(&c);
 
-	// generalize
+	// generalize variables that did not escape to the current level
 	def = represent(types, def);
 	std::set<type::var> exclude = dangerous(def);
 	
-	type::poly gen = generalize(c, def, exclude);
+	type::poly gen = generalize(types, def, exclude);
 	
 	sub.set(self.id, gen);
 	
@@ -604,7 +675,7 @@ struct algorithm_w {
   type::mono operator()(const ast::lit<T>& , const context& ) const {
 	debug_raii debug("lit");
     type::poly p = type::traits<T>::type();
-    type::mono res = p.apply<type::mono>(instantiate());
+    type::mono res = p.apply<type::mono>(instantiate{types});
     debug.type = res;
     return res;
   }
@@ -628,16 +699,21 @@ struct algorithm_w {
 
 type::poly hindley_milner(union_find<type::mono>& types, const context& ctx, const ast::expr& e) {
   
-  // compute monotype in current context
-  type::mono t = e.apply<type::mono>( algorithm_w{types}, ctx);
-
+  // compute monotype in current context, one level deeper than the
+  // context
+  type::mono t;
+  {
+	level_raii level(types);
+	t = e.apply<type::mono>( algorithm_w{types}, ctx);
+  }
+  
   t = represent(types, t);
 
   // restrict quantification for let bindings
   if(e.is<ast::let>() ) {
-	return generalize(ctx, t, dangerous(t) );
+	return generalize(types, t, dangerous(t) );
   } else {
-	return generalize(ctx, t);
+	return generalize(types, t);
   }
   
 }
@@ -79,6 +79,14 @@ public:
 // unbound in ctx
 type::poly generalize(const context& ctx, const type::mono& t, const std::set<type::var>& exclude = {});
 
+// generalize monotype t given variable levels in types i.e. quantify
+// all variables deeper than the current let-depth. t should be
+// represented first.
+type::poly generalize(union_find<type::mono>& types, const type::mono& t, const std::set<type::var>& exclude = {});
+
+// true if polytype p has no free type variables
+bool closed(const type::poly& p);
+
 // hindley-milner type inference for expression e in context ctx.
 type::poly hindley_milner(union_find<type::mono>& types, const context& ctx, const ast::expr& e);
 
@@ -9,11 +9,11 @@ LIBS += $$system( $$LLVM_CONFIG --libs) -ltinfo -lpthread -ldl -lz
 
 SOURCES = common.cpp sexpr.cpp  \
 		ast.cpp type.cpp  syntax.cpp hindley_milner.cpp \
-		parse.cpp repl.cpp \
+		toplevel.cpp thread_pool.cpp parse.cpp repl.cpp \
 		code.cpp \
 		jit.cpp \
-# 		builtin.cpp \
-# 		lisp.cpp \
+		lisp.cpp gc.cpp profile.cpp native.cpp image.cpp autoload.cpp \
+		builtin.cpp vm.cpp \
 		main.cpp
 
 LIBS += -lreadline # -lstdc++
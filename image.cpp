@@ -0,0 +1,624 @@
+#include "lisp.hpp"
+#include "builtin.hpp"
+
+#include <fstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace lisp {
+
+  // heap images are the global environment and the macro table saved after
+  // the prelude, so that later sessions load them instead of evaluating
+  // init.lisp again. the heap reachable from there is written as a table
+  // of object records referencing each other by index (shared and cyclic
+  // structure is kept), with symbols and builtins saved by name:
+  //
+  //   magic, symbols, object types and offsets, roots, records
+  //
+  // closures are saved as the builtin call that built them. images are
+  // mapped when loaded, and objects are allocated before being filled so
+  // that records may reference each other in any order, except for lists
+  // and closures which are built from their (acyclic) contents.
+
+  static const char magic[8] = {'h', 'm', 'i', 'm', 'a', 'g', 'e', '3'};
+
+  // value encoding
+  enum kind : std::uint8_t {
+	undefined_kind,
+	boolean_kind,
+	integer_kind,
+	real_kind,
+	symbol_kind,
+	builtin_kind,
+	object_kind,				// object index
+	null_kind,					// null heap value, and its tag
+  };
+
+
+  struct heap_type {
+	template<class T>
+	tag operator()(const handle<T>& ) const { return heap_tag<T>::value; }
+
+	template<class T>
+	tag operator()(const T& ) const { throw std::logic_error("heap value expected"); }
+  };
+
+
+  class image_writer {
+	std::string out;
+
+	// symbol indices start at 1, 0 is the null symbol
+	vec<const char*> symbols;
+	std::unordered_map<const char*, std::uint32_t> symbol_index;
+
+	// objects waiting for their record
+	vec<value> objects;
+	std::unordered_map<const void*, std::uint32_t> object_index;
+
+	template<class T>
+	void raw(const T& x) {
+	  out.append(reinterpret_cast<const char*>(&x), sizeof(T));
+	}
+
+	void put(symbol s) {
+	  if( !s.name() ) return raw<std::uint32_t>(0);
+
+	  auto it = symbol_index.find(s.name());
+	  if( it == symbol_index.end() ) {
+		symbols.push_back(s.name());
+		it = symbol_index.emplace(s.name(), symbols.size()).first;
+	  }
+
+	  raw(it->second);
+	}
+
+	void put(const vec<symbol>& syms) {
+	  raw<std::uint32_t>(syms.size());
+	  for(symbol s : syms) put(s);
+	}
+
+
+	struct encode {
+
+	  void operator()(boolean x, image_writer& self) const {
+		self.raw(boolean_kind);
+		self.raw<std::uint8_t>(x);
+	  }
+
+	  void operator()(integer x, image_writer& self) const {
+		self.raw(integer_kind);
+		self.raw(x);
+	  }
+
+	  void operator()(real x, image_writer& self) const {
+		self.raw(real_kind);
+		self.raw(x);
+	  }
+
+	  void operator()(symbol x, image_writer& self) const {
+		self.raw(symbol_kind);
+		self.put(x);
+	  }
+
+	  void operator()(builtin x, image_writer& self) const {
+		const char* name = primitive_name(x);
+		if( !name ) throw error("cannot save unregistered builtin");
+
+		self.raw(builtin_kind);
+		self.put(symbol(name));
+	  }
+
+	  template<class T>
+	  void operator()(const handle<T>& x, image_writer& self) const {
+		if( !x ) {
+		  self.raw(null_kind);
+		  self.raw<std::uint16_t>(heap_tag<T>::value);
+		  return;
+		}
+
+		auto it = self.object_index.find(x.get());
+		if( it == self.object_index.end() ) {
+		  it = self.object_index.emplace(x.get(), self.objects.size()).first;
+		  self.objects.push_back(x);
+		}
+
+		self.raw(object_kind);
+		self.raw(it->second);
+	  }
+
+	};
+
+
+	void put(const value& x) {
+	  if( !x ) return raw(undefined_kind);
+	  x.apply(encode(), *this);
+	}
+
+
+	struct record {
+
+	  void operator()(const list& x, image_writer& self) const {
+		self.put(x->head);
+		self.put(x->tail);
+	  }
+
+	  void operator()(const string& x, image_writer& self) const {
+		self.raw<std::uint32_t>(x->size());
+		self.out.append(*x);
+	  }
+
+	  void operator()(const lambda& x, image_writer& self) const {
+		self.put(x->env);
+		self.put(x->args);
+		self.put(x->vararg ? *x->vararg : symbol());
+		self.put(x->body);
+		self.put(x->defs);
+		self.put(x->name);
+		self.raw<std::uint8_t>(x->escapes);
+		self.raw<std::uint8_t>(x->rest);
+	  }
+
+	  void operator()(const environment& x, image_writer& self) const {
+		self.put(x->parent);
+		self.put(x->self);
+
+		self.raw<std::uint32_t>(x->slots.size());
+		for(const value& s : x->slots) self.put(s);
+
+		self.raw<std::uint32_t>(x->size());
+		for(const auto& it : *x) {
+		  self.put(it.first);
+		  self.put(it.second);
+		}
+	  }
+
+	  void operator()(const object& x, image_writer& self) const {
+		self.put(x->type);
+
+		self.raw<std::uint32_t>(x->slots.size());
+		for(std::size_t i = 0, n = x->slots.size(); i < n; ++i) {
+		  self.put(x->shape->name(i));
+		  self.put(x->slots[i]);
+		}
+	  }
+
+	  void operator()(const closure& x, image_writer& self) const {
+		if( !x->source ) throw error("cannot save closure");
+		self.put(x->source);
+	  }
+
+	  void operator()(const address& x, image_writer& self) const {
+		self.put(x->name);
+		self.raw(x->depth);
+		self.raw(x->index);
+	  }
+
+	  template<class T>
+	  void operator()(const T&, image_writer&) const {
+		throw std::logic_error("heap value expected");
+	  }
+
+	};
+
+  public:
+
+	void save(const environment& env, const std::string& path) {
+	  autoload_all();
+	  put(env);
+
+	  const std::map<symbol, lambda>& table = macros();
+	  raw<std::uint32_t>(table.size());
+	  for(const auto& it : table) {
+		put(it.first);
+		put(it.second);
+	  }
+
+	  const std::string roots = std::move(out);
+
+	  // records add the objects they reference
+	  out.clear();
+	  vec<std::uint64_t> offsets;
+
+	  for(std::size_t i = 0; i < objects.size(); ++i) {
+		offsets.push_back(out.size());
+
+		// objects may grow
+		const value x = objects[i];
+		x.apply(record(), *this);
+	  }
+
+	  const std::string records = std::move(out);
+
+	  out.clear();
+	  out.append(magic, sizeof(magic));
+
+	  raw<std::uint32_t>(symbols.size());
+	  for(const char* s : symbols) {
+		const std::uint32_t size = std::strlen(s);
+		raw(size);
+		out.append(s, size);
+	  }
+
+	  raw<std::uint32_t>(objects.size());
+	  for(std::size_t i = 0, n = objects.size(); i < n; ++i) {
+		raw<std::uint16_t>(objects[i].apply<tag>(heap_type()));
+		raw(offsets[i]);
+	  }
+
+	  out += roots;
+	  out += records;
+
+	  std::ofstream file(path, std::ios::binary);
+	  if( !file.write(out.data(), out.size()) ) {
+		throw error("cannot write image " + path);
+	  }
+	}
+
+  };
+
+
+
+  // read-only mapping of an image file
+  struct mapping {
+	int fd = -1;
+	void* data = MAP_FAILED;
+	std::size_t size = 0;
+
+	mapping(const std::string& path) {
+	  fd = open(path.c_str(), O_RDONLY);
+	  if( fd == -1 ) throw error("cannot open image " + path);
+
+	  struct stat info;
+	  if( fstat(fd, &info) == -1 || !info.st_size ) {
+		close(fd);
+		throw error("bad image " + path);
+	  }
+
+	  size = info.st_size;
+	  data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	  if( data == MAP_FAILED ) {
+		close(fd);
+		throw error("cannot map image " + path);
+	  }
+	}
+
+	mapping(const mapping& ) = delete;
+	
+	~mapping() {
+	  if( data != MAP_FAILED ) munmap(data, size);
+	  if( fd != -1 ) close(fd);
+	}
+  };
+
+
+  class image_reader {
+	const char* pos;
+	const char* last;
+
+	// index 0 is the null symbol
+	vec<symbol> symbols;
+
+	struct entry {
+	  tag type;
+	  std::uint64_t offset;
+	};
+	
+	vec<entry> entries;
+	const char* records;
+
+	// undefined until allocated
+	vec<value> objects;
+	vec<bool> visiting;
+
+	environment global;
+	
+	static constexpr std::uint32_t none = -1;
+
+	template<class T>
+	T raw() {
+	  if( std::size_t(last - pos) < sizeof(T) ) throw error("truncated image");
+
+	  T res;
+	  std::memcpy(&res, pos, sizeof(T));
+	  pos += sizeof(T);
+	  return res;
+	}
+
+	symbol get_symbol() {
+	  const std::uint32_t i = raw<std::uint32_t>();
+	  if( i >= symbols.size() ) throw error("bad symbol in image");
+	  return symbols[i];
+	}
+
+	vec<symbol> get_symbols() {
+	  vec<symbol> res(raw<std::uint32_t>());
+	  for(symbol& s : res) s = get_symbol();
+	  return res;
+	}
+
+	std::uint32_t index() {
+	  const std::uint32_t res = raw<std::uint32_t>();
+	  if( res >= entries.size() ) throw error("bad object in image");
+	  return res;
+	}
+
+	static value null_value(std::uint16_t type) {
+	  switch( type ) {
+	  case list_tag: return list();
+	  case string_tag: return string();
+	  case lambda_tag: return lambda();
+	  case environment_tag: return environment();
+	  case object_tag: return object();
+	  case closure_tag: return closure();
+	  case address_tag: return address();
+	  default: throw error("bad value in image");
+	  }
+	}
+	
+	value get() {
+	  switch( raw<kind>() ) {
+	  case undefined_kind: return {};
+	  case boolean_kind: return boolean( raw<std::uint8_t>() );
+	  case integer_kind: return raw<integer>();
+	  case real_kind: return raw<real>();
+	  case symbol_kind: return get_symbol();
+	  case builtin_kind: {
+		const symbol name = get_symbol();
+		const builtin res = primitive(name);
+		if( !res ) throw error("unknown builtin in image: " + std::string(name.name()));
+		return res;
+	  }
+	  case object_kind: return objects[ index() ];
+	  case null_kind: return null_value( raw<std::uint16_t>() );
+	  default: throw error("bad value in image");
+	  }
+	}
+
+	template<class T>
+	handle<T> get() {
+	  const value res = get();
+	  if( !res.is< handle<T> >() ) throw error("bad value in image");
+	  return res.as< handle<T> >();
+	}
+
+	// object index of the next value, none otherwise
+	std::uint32_t next_ref() {
+	  const char* start = pos;
+	  if( raw<kind>() == object_kind ) return index();
+
+	  pos = start;
+	  get();
+	  return none;
+	}
+	
+	void seek(std::uint32_t id) {
+	  if( entries[id].offset > std::uint64_t(last - records) ) throw error("bad object in image");
+	  pos = records + entries[id].offset;
+	}
+
+	
+	// objects other than lists and closures are allocated first
+	void allocate(std::uint32_t id) {
+	  seek(id);
+
+	  switch( entries[id].type ) {
+	  case string_tag: {
+		const std::uint32_t size = raw<std::uint32_t>();
+		if( std::size_t(last - pos) < size ) throw error("truncated image");
+		objects[id] = make<string_type>(pos, size);
+		break;
+	  }
+	  case address_tag: {
+		const symbol name = get_symbol();
+		const std::uint32_t depth = raw<std::uint32_t>();
+		objects[id] = make<address_type>(name, depth, raw<std::uint32_t>());
+		break;
+	  }
+	  case lambda_tag: objects[id] = make<lambda_type>(); break;
+	  case environment_tag: objects[id] = make<environment_type>(); break;
+	  case object_tag: objects[id] = make<object_type>( get_symbol() ); break;
+	  case list_tag:
+	  case closure_tag:
+		break;
+	  default:
+		throw error("bad object in image");
+	  }
+	}
+
+
+	value construct(std::uint32_t id) {
+	  seek(id);
+	  
+	  if( entries[id].type == list_tag ) {
+		const value head = get();
+		return make<cons>(head, get<cons>());
+	  }
+
+	  // call the builtin that made the closure
+	  const list source = get<cons>();
+	  if( !source || !source->head.is<builtin>() ) throw error("bad closure in image");
+
+	  vec<value> args;
+	  for(const value& x : source->tail) args.push_back(x);
+
+	  const value res = source->head.as<builtin>()(global, args.data(), args.data() + args.size());
+	  if( !res.is<closure>() ) throw error("bad closure in image");
+
+	  return res;
+	}
+	
+	
+	// lists and closures are built after their contents, which cannot
+	// reference them back
+	void build(std::uint32_t id) {
+	  vec<std::uint32_t> stack = {id};
+
+	  while( !stack.empty() ) {
+		const std::uint32_t top = stack.back();
+		if( objects[top] ) {
+		  stack.pop_back();
+		  continue;
+		}
+
+		const std::size_t size = stack.size();
+		seek(top);
+		
+		for(std::size_t i = 0, n = entries[top].type == list_tag ? 2 : 1; i < n; ++i) {
+		  const std::uint32_t ref = next_ref();
+		  if( ref == none || objects[ref] ) continue;
+		  
+		  if( visiting[ref] ) throw error("cyclic list in image");
+		  stack.push_back(ref);
+		}
+
+		if( stack.size() > size ) {
+		  visiting[top] = true;
+		  continue;
+		}
+		
+		objects[top] = construct(top);
+		stack.pop_back();
+	  }
+	}
+
+
+	void fill(std::uint32_t id) {
+	  seek(id);
+	  
+	  switch( entries[id].type ) {
+	  case lambda_tag: {
+		lambda_type& self = *objects[id].as<lambda>();
+		self.env = get<environment_type>();
+		self.args = get_symbols();
+
+		const symbol vararg = get_symbol();
+		if( vararg.name() ) self.vararg = shared<symbol>(vararg);
+
+		self.body = get();
+		self.defs = get_symbols();
+		self.name = get_symbol();
+		self.escapes = raw<std::uint8_t>();
+		self.rest = raw<std::uint8_t>();
+		break;
+	  }
+	  case environment_tag: {
+		environment_type& self = *objects[id].as<environment>();
+		self.parent = get<environment_type>();
+		self.self = get<lambda_type>();
+
+		self.slots.resize( raw<std::uint32_t>() );
+		for(value& x : self.slots) x = get();
+
+		for(std::uint32_t i = 0, n = raw<std::uint32_t>(); i < n; ++i) {
+		  const symbol name = get_symbol();
+		  self.insert( {name, get()} );
+		}
+
+		++environment_type::epoch;
+		break;
+	  }
+	  case object_tag: {
+		object_type& self = *objects[id].as<object>();
+		get_symbol();
+
+		// same attribute order, same shape
+		for(std::uint32_t i = 0, n = raw<std::uint32_t>(); i < n; ++i) {
+		  const symbol name = get_symbol();
+		  self.set(name, get());
+		}
+		break;
+	  }
+	  default:
+		break;
+	  }
+	}
+
+  public:
+
+	environment load(const std::string& path) {
+	  const mapping file(path);
+
+	  pos = static_cast<const char*>(file.data);
+	  last = pos + file.size;
+
+	  if( file.size < sizeof(magic) || std::memcmp(pos, magic, sizeof(magic)) ) {
+		throw error("bad image " + path);
+	  }
+
+	  pos += sizeof(magic);
+
+	  symbols.emplace_back();
+	  for(std::uint32_t i = 0, n = raw<std::uint32_t>(); i < n; ++i) {
+		const std::uint32_t size = raw<std::uint32_t>();
+		if( std::size_t(last - pos) < size ) throw error("truncated image");
+
+		symbols.emplace_back(pos, size);
+		pos += size;
+	  }
+
+	  entries.resize( raw<std::uint32_t>() );
+	  for(entry& e : entries) {
+		e.type = tag( raw<std::uint16_t>() );
+		e.offset = raw<std::uint64_t>();
+	  }
+
+	  // global environment and macros
+	  const char* roots = pos;
+	  next_ref();
+	  for(std::uint32_t i = 0, n = raw<std::uint32_t>(); i < n; ++i) {
+		get_symbol();
+		next_ref();
+	  }
+
+	  records = pos;
+	  objects.resize(entries.size());
+	  visiting.resize(entries.size());
+
+	  for(std::uint32_t i = 0, n = entries.size(); i < n; ++i) {
+		allocate(i);
+	  }
+
+	  pos = roots;
+	  global = get<environment_type>();
+	  if( !global ) throw error("bad image " + path);
+	  
+	  for(std::uint32_t i = 0, n = entries.size(); i < n; ++i) {
+		build(i);
+	  }
+
+	  for(std::uint32_t i = 0, n = entries.size(); i < n; ++i) {
+		fill(i);
+	  }
+
+	  pos = roots;
+	  get();
+
+	  std::map<symbol, lambda>& table = macros();
+	  for(std::uint32_t i = 0, n = raw<std::uint32_t>(); i < n; ++i) {
+		const symbol name = get_symbol();
+		table[name] = get<lambda_type>();
+	  }
+
+	  rewrites();
+	  return global;
+	}
+	
+  };
+
+  
+  namespace image {
+
+	void save(const environment& env, const std::string& path) {
+	  image_writer().save(env, path);
+	}
+
+	environment load(const std::string& path) {
+	  return image_reader().load(path);
+	}
+	
+  }
+  
+}
@@ -4,32 +4,12 @@
 
 
 ;; list functions
-(def list-length (lambda (x)
-			  (cond ((null? x) 0)
-					('else (number-add 1 (list-length (cdr x)))))))
+(def length list-length)
 
 (def cadr (lambda (x) (car (cdr x))))
 
-(def list-map (lambda (x f)
-		   (cond ((null? x) x)
-				 ('else (cons (f (car x)) (list-map (cdr x) f))))))
-
-(def list-each (lambda (x f)
-				(cond ((null? x) '())
-					  ('else (do (f (car x)) (list-each (cdr x) f))))))
-
 (def list (lambda args args))
 
-(def list-append (lambda (lhs rhs)
-                         (cond ((null? lhs) rhs)
-                               ('else (cons (car lhs) (list-append (cdr lhs) rhs))))))
-
-
-(def nth (lambda (x n)
-		   (cond ((null? x) (error "index out of bounds"))
-				 ((number=? n 0) (car x))
-				 ('else (nth (cdr x) (number-sub n 1))))))
-
 
 ;; TODO unquote-splicing ?
 (defmacro quasiquote (e)
@@ -150,6 +130,12 @@
 (instance Diff int (- number-sub))
 (instance Diff real (- number-sub))
 
+(class Prod a
+       (* a a))
+
+(instance Prod int (* number-mul))
+(instance Prod real (* number-mul))
+
 (class Eq a
        (= a a))
 
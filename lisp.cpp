@@ -1,8 +1,9 @@
 #include "lisp.hpp"
-#include "vla.hpp"
 
 #include <algorithm>
 #include <sstream>
+#include <functional>
+#include <cstdlib>
 
 // #include "debug.hpp"
 
@@ -11,33 +12,131 @@ namespace lisp {
   // this will be useful
   static error unimplemented("unimplemented");
 
+  // calls in tail position: instead of evaluating expr, forms fill this
+  // and eval loops, in env when given or in the current environment
+  struct tail_call {
+	environment env;
+	value expr;
+
+	// lambda called in env, for the profiler
+	const lambda_type* callee = nullptr;
+  };
+  
+  // evaluated arguments live on a stack of values owned by each thread,
+  // in chunks that never move so that builtins read their arguments in
+  // place while nested calls push more. values on the stack are exactly
+  // the arguments of pending calls, a precise set of roots.
+  struct value_stack {
+	value* top = nullptr;
+	value* limit = nullptr;
+
+	// index of the current chunk
+	std::size_t current = 0;
+
+	// kept for the thread lifetime, so that the stack needs no destructor
+	// and thread-local accesses no initialization check
+	vec< std::pair<value*, std::size_t> >* chunks = nullptr;
+
+	static constexpr std::size_t chunk_size = 4096;
+
+	// next chunk with room for n values
+	value* grow(std::size_t n) {
+	  if( !chunks ) chunks = new vec< std::pair<value*, std::size_t> >;
+	  if( top ) ++current;
+
+	  if( current == chunks->size() ) chunks->emplace_back(nullptr, 0);
+
+	  // chunks past the current one are unused
+	  auto& c = (*chunks)[current];
+	  if( c.second < n ) {
+		delete[] c.first;
+		c.second = n > chunk_size ? n : chunk_size;
+		c.first = new value[c.second];
+	  }
+
+	  top = c.first + n;
+	  limit = c.first + c.second;
+	  return c.first;
+	}
+	
+	template<class F>
+	void trace(F&& f) {
+	  if( !top ) return;
+
+	  for(std::size_t i = 0; i < current; ++i) {
+		// chunks are left when full enough, values past their top are undefined
+		for(std::size_t j = 0, n = (*chunks)[i].second; j < n; ++j) f((*chunks)[i].first[j]);
+	  }
+
+	  for(value* it = (*chunks)[current].first; it != top; ++it) f(*it);
+	}
+	
+  };
+
+  static thread_local value_stack stack;
+
+
+  // call arguments on the value stack, popped on scope exit
+  class arguments {
+	const value_stack saved;
+	value* first;
+	value* last;
+	
+  public:
+	arguments(std::size_t size) : saved(stack) {
+	  if( std::size_t(stack.limit - stack.top) >= size ) {
+		first = stack.top;
+		stack.top += size;
+	  } else {
+		first = stack.grow(size);
+	  }
+
+	  last = first + size;
+	}
+	
+	arguments(const arguments& ) = delete;
+
+	~arguments() {
+	  for(value* it = first; it != last; ++it) *it = value();
+
+	  stack.top = saved.top;
+	  stack.limit = saved.limit;
+	  stack.current = saved.current;
+	}
+
+	value* begin() const { return first; }
+	value* end() const { return last; }
+  };
+  
+  
   // special forms
-  using special_form = value (*) (environment& env, const list& args);
+  using special_form = value (*) (environment& env, const list& args, tail_call& tail);
   
-  static value eval_define(environment& env, const list& args);
-  static value eval_lambda(environment& env, const list& args);
-  static value eval_quote(environment& env, const list& args);
-  static value eval_cond(environment& env, const list& args);
-  static value eval_begin(environment& env, const list& args);
-  static value eval_set(environment& env, const list& args);
-  static value eval_defmacro(environment& env, const list& args);
+  static value eval_define(environment& env, const list& args, tail_call& tail);
+  static value eval_lambda(environment& env, const list& args, tail_call& tail);
+  static value eval_quote(environment& env, const list& args, tail_call& tail);
+  static value eval_cond(environment& env, const list& args, tail_call& tail);
+  static value eval_begin(environment& env, const list& args, tail_call& tail);
+  static value eval_set(environment& env, const list& args, tail_call& tail);
+  static value eval_defmacro(environment& env, const list& args, tail_call& tail);
   
   // TODO import ?
 
-  static struct {
-	symbol define = "def";
-	symbol lambda = "lambda";
-	symbol quote = "quote";
-	symbol begin = "do";
-	symbol cond = "cond";
-	symbol set = "set!";
-	symbol defmacro = "defmacro";
+  static struct keywords {
+	symbol define, lambda, fn, quote, begin, cond, set, defmacro;
+
+	keywords() {
+	  symbol::intern({{&define, "def"}, {&lambda, "lambda"}, {&fn, "fn"},
+					  {&quote, "quote"}, {&begin, "do"}, {&cond, "cond"},
+					  {&set, "set!"}, {&defmacro, "defmacro"}});
+	}
   } keyword;
 
   
   static std::unordered_map<symbol, special_form> special = {
 	{keyword.define, eval_define},
 	{keyword.lambda, eval_lambda},
+	{keyword.fn, eval_lambda},
 	{keyword.quote, eval_quote},   	
 	{keyword.cond, eval_cond},
 	{keyword.begin, eval_begin},
@@ -49,6 +148,11 @@ namespace lisp {
   // macro table
   static std::map<symbol, lambda> macro;
 
+  // builtin call rewrites, and how to show rewritten calls
+  static std::unordered_map<symbol, rewrite> rewrites, sources;
+
+  static value expand_site(environment& env, const list& self, const lambda& m);
+
   
   struct application {
 
@@ -59,20 +163,20 @@ namespace lisp {
 	  return make_list(start, end);
 	}
 	
-	// lambda application
+	// call frame for lambda application
 	template<class Iterator>
-	inline value operator()(const lambda& self, environment&, Iterator arg, Iterator end) const {
+	static environment frame(const lambda& self, Iterator arg, Iterator end) {
 	
-	  environment sub = shared<environment_type>(self->env);
+	  environment sub = environment_type::frame(self);
 
-	  // argument names
-	  auto name = self->args.begin(), name_end = self->args.end();	  
-	  for(; name != name_end && arg != end; ++name, ++arg) {
-		sub->insert( {*name, *arg} );
+	  // arguments
+	  const std::size_t n = self->args.size();
+	  std::size_t i = 0;
+	  for(; i < n && arg != end; ++i, ++arg) {
+		sub->slots[i] = *arg;
 	  }
-
 	  
-	  if( (arg == end && name != name_end) || (name == name_end && arg != end && !self->vararg) ) {
+	  if( (arg == end && i != n) || (i == n && arg != end && !self->vararg) ) {
 		error e("bad argument count");
 		std::stringstream ss;
 		ss << "expected: " << self->args.size() << (self->vararg ? "+" : "") << std::endl;
@@ -81,9 +185,37 @@ namespace lisp {
 
 	  }
 	  
-	  // varargs
-	  if( self->vararg ) {
-		(*sub)[ *self->vararg ] = to_list(arg, end); 
+	  // varargs, unless unused
+	  if( self->vararg && self->rest ) {
+		sub->slots[n] = to_list(arg, end); 
+	  }
+	  
+	  return sub;
+	}
+
+	
+	// hot lambdas may run as native code
+	static bool hot(const lambda& self, value* arg, value* end, value& res) {
+	  if( self->countdown && !--self->countdown ) native::compile(self);
+	  return self->code && native::call(self, arg, end, res);
+	}
+
+	// macro arguments are passed as lists
+	static bool hot(const lambda&, const list&, const list&, value&) { return false; }
+	
+	
+	// lambda application
+	template<class Iterator>
+	inline value operator()(const lambda& self, environment&, Iterator arg, Iterator end) const {
+	  value res;
+	  if( hot(self, arg, end, res) ) return res;
+	  
+	  environment sub = frame(self, arg, end);
+
+	  if( profile::enabled ) {
+		profile::frame calls;
+		calls.call(self.get());
+		return eval(sub, self->body);
 	  }
 	  
 	  return eval(sub, self->body);
@@ -122,7 +254,8 @@ namespace lisp {
 
   
   struct evaluate {
-
+	tail_call& tail;
+	
 	// lists
 	inline value operator()(const list& self, environment& env) const {
 	  
@@ -138,7 +271,7 @@ namespace lisp {
 		{
 		  auto it = special.find( s );
 		  if( it != special.end() ) {
-			return it->second(env, self->tail);
+			return it->second(env, self->tail, tail);
 		  }
 		}
 
@@ -147,33 +280,50 @@ namespace lisp {
 		  auto it = macro.find( s );
 		  if( it != macro.end() ) {
 
-			const value expansion = application()(it->second, env, self->tail, null);
+			const value expansion = expand_site(env, self, it->second);
 			
 			// debug<2>() << "macro:\t" << value(self) << std::endl
 			// 		   << "\t>>\t" << exp << std::endl;
 			
 			// evaluate result
-			return eval(env, expansion);
+			tail.expr = expansion;
+			return {};
 		  }
 		}
-	  } 
+	  } else if( head.is<address>() && head.as<address>()->index == address_type::global ) {
 
+		// macros defined after the enclosing lambda was resolved
+		auto it = macro.find( head.as<address>()->name );
+		if( it != macro.end() ) {
+		  tail.expr = expand_site(env, self, it->second);
+		  return {};
+		}
+	  }
 	  
 	  
 	  // regular function application
 	  const value func = eval(env, self->head);
 
-	  // TODO make function c-style variadic and simply push values
-	  // onto the stack ?
+	  // evaluated args
+	  const arguments args( length(self->tail) );
+	  
+	  value* arg = args.begin();
+	  for(value& v : self->tail) {
+		*arg++ = eval(env, v);
+	  }
 
-	  // vla for evaluated args
-	  const unsigned argc = length(self->tail);
+	  // lambda calls continue in their frame, where arguments are moved
+	  if( func.is<lambda>() ) {
+		const lambda& self = func.as<lambda>();
 
-	  macro_vla(value, args, argc);
-	  unsigned i = 0;
-	  for(value& v : self->tail) {
-		args.data[i] = eval(env, v);
-		++i;
+		value res;
+		if( application::hot(self, args.begin(), args.end(), res) ) return res;
+		
+		tail.env = application::frame(self, std::make_move_iterator(args.begin()),
+									  std::make_move_iterator(args.end()));
+		tail.expr = self->body;
+		tail.callee = self.get();
+		return {};
 	  }
 	  
 	  return apply(env, func, args.begin(), args.end() );
@@ -188,6 +338,27 @@ namespace lisp {
 		});
 
 	}
+
+
+	// resolved variables
+	inline value operator()(const address& self, environment& env) const {
+
+	  return env->find( self, [&] {
+		  throw error("unbound variable: " + std::string(self->name.name()) );
+		});
+	  
+	}
+
+
+	// resolved lambda expressions
+	inline value operator()(const lambda& self, environment& env) const {
+	  if( self->env ) return self;
+
+	  lambda res = make<lambda_type>(*self);
+	  res->env = env;
+
+	  return res;
+	}
 	
 	
 	// all the rest is returned as is
@@ -199,25 +370,206 @@ namespace lisp {
   };
   
 
-  // eval
-  value eval(environment& env, const value& expr) {
+  // expr as written, for error messages
+  static value written(const value& expr) {
+	if( sources.empty() || !expr.is<list>() || !expr.as<list>() ) return expr;
+
+	const value& head = expr.as<list>()->head;
+	if( head.is<symbol>() && head.as<symbol>() == keyword.quote ) return expr;
+	
+	vec<value> xs;
+	for(const value& xi : expr.as<list>()) xs.push_back( written(xi) );
+	const list res = make_list(xs.begin(), xs.end());
+
+	const symbol name = head.is<address>() ? head.as<address>()->name :
+	  head.is<symbol>() ? head.as<symbol>() : symbol();
+	if( !name.name() ) return res;
+	
+	auto it = sources.find(name);
+	if( it == sources.end() ) return res;
+	
+	return it->second(res);
+  }
+  
+  
+  static inline value eval(environment& env, const value& expr, tail_call& tail) {
 	try { 
-	  return expr.apply<value>(evaluate(), env);
+	  return expr.apply<value>(evaluate{tail}, env);
 	} catch( error& e ) {
 	  std::stringstream ss;
-	  ss << "  ...  " << expr << '\n' << e.details;
+	  ss << "  ...  " << written(expr) << '\n' << e.details;
 	  e.details = ss.str();
 	  throw e;
 	}
   }
+  
+  
+  // eval: tail calls loop in constant stack
+  value eval(environment& env, const value& expr) {
+	tail_call tail;
+	value res = eval(env, expr, tail);
+	
+	if( !tail.expr ) return res;
+
+	environment current = env;
+	value x;
+	profile::frame calls;
+	
+	try {
+	  do {
+		if( tail.env ) {
+		  current = std::move(tail.env);
+		  if( profile::enabled ) calls.call(tail.callee);
+		}
+		
+		x = std::move(tail.expr);
+		tail = {};
+		
+		res = eval(current, x, tail);
+	  } while( tail.expr );
+	} catch( error& e ) {
+	  std::stringstream ss;
+	  ss << "  ...  " << written(expr) << '\n' << e.details;
+	  e.details = ss.str();
+	  throw e;
+	}
+	
+	return res;
+  }
 
   
   value apply(environment& env, const value& expr, value* arg, value* end) {
 	return expr.apply<value>(application(), env, arg, end);
   }
+
+
+  // expand elements of x, keeping the first n as they are
+  static list expand_tail(environment& env, const list& x, unsigned n) {
+	vec<value> res;
+
+	for(const value& xi : x) {
+	  res.push_back( n ? xi : expand(env, xi) );
+	  if( n ) --n;
+	}
+
+	return make_list(res.begin(), res.end());
+  }
+
+  
+  value expand(environment& env, const value& expr) {
+	if( !expr.is<list>() || !expr.as<list>() ) return expr;
+
+	const list& self = expr.as<list>();
+	
+	if( self->head.is<symbol>() ) {
+	  const symbol& s = self->head.as<symbol>();
+
+	  if( s == keyword.quote || s == keyword.defmacro ) return expr;
+	  
+	  if( s == keyword.lambda || s == keyword.fn ||
+		  s == keyword.define || s == keyword.set ) {
+		return expand_tail(env, self, 2);
+	  }
+
+	  if( s == keyword.cond ) {
+		vec<value> clauses = { s };
+		
+		for(const value& c : self->tail) {
+		  clauses.push_back( c.is<list>() ? expand_tail(env, c.as<list>(), 0) : c );
+		}
+		
+		return make_list(clauses.begin(), clauses.end());
+	  }
+
+	  if( special.find(s) != special.end() ) return expand_tail(env, self, 1);
+
+	  auto it = macro.find(s);
+	  if( it == macro.end() && autoload_macro(s) ) it = macro.find(s);
+	  
+	  if( it != macro.end() ) {
+		// macros may rely on lazy expansion for their base case, e.g. (and):
+		// errors are reported when the form is actually evaluated
+		try {
+		  return expand_site(env, self, it->second);
+		} catch( error& ) {
+		  return expr;
+		}
+	  }
+
+	  auto r = rewrites.find(s);
+	  if( r != rewrites.end() ) return r->second( expand_tail(env, self, 0) );
+	}
+
+	return expand_tail(env, self, 0);
+  }
+
+
+  void define_rewrite(symbol name, rewrite f) {
+	rewrites[name] = f;
+  }
+
+
+  void define_source(symbol head, rewrite f) {
+	sources[head] = f;
+  }
+
+
+  // call site expansion cache. entries keep their call site alive so
+  // that its address is not reused, and remember their macro
+  struct expansion {
+	list site;
+	lambda macro;
+	value result;
+  };
+
+  static std::unordered_map<const cons*, expansion> expansions;
+  static std::size_t expansions_limit = 1024;
+  
+  static struct expansion_stats stats;
+  
+  static value expand_site(environment& env, const list& self, const lambda& m) {
+	{
+	  auto it = expansions.find( self.get() );
+	  if( it != expansions.end() && it->second.macro == m ) {
+		++stats.avoided;
+		return it->second.result;
+	  }
+	}
+	
+	++stats.expanded;
+	const value res = expand(env, application()(m, env, self->tail, null));
+	
+	// drop entries for dead call sites
+	if( expansions.size() >= expansions_limit ) {
+	  for(auto it = expansions.begin(); it != expansions.end(); ) {
+		if( it->second.site.unique() ) it = expansions.erase(it);
+		else ++it;
+	  }
+	  
+	  expansions_limit = std::max<std::size_t>(1024, 2 * expansions.size());
+	}
+	
+	expansions[ self.get() ] = {self, m, res};
+	return res;
+  }
+
+
+  const expansion_stats& macro_stats() {
+	return stats;
+  }
+
+
+  bool is_macro(symbol name) {
+	return macro.find(name) != macro.end();
+  }
+
+
+  std::map<symbol, lambda>& macros() {
+	return macro;
+  }
   
   // special forms
-  static value eval_define(environment& env, const list& args) {
+  static value eval_define(environment& env, const list& args, tail_call&) {
 
 	const unsigned argc = length(args);
 	
@@ -230,13 +582,19 @@ namespace lisp {
 
 	// TODO eval first ?
 	value expr = eval(env, args->tail->head);
-	(*env)[ args->head.as<symbol>() ] = expr;
+
+	if( expr.is<lambda>() && !expr.as<lambda>()->name.name() ) {
+	  expr.as<lambda>()->name = args->head.as<symbol>();
+	}
+	
+	env->define(args->head.as<symbol>(), expr);
 	
 	return null;
   }
 
   
-  static value eval_lambda(environment& env, const list& args) {
+  // lambda expression syntax, body is left unresolved
+  static lambda make_lambda(const list& args) {
 	static const symbol dot = ".";
 	
 	const unsigned argc = length(args);
@@ -247,7 +605,7 @@ namespace lisp {
 	  throw error("expected variable list or symbol for lambda arguments");
 	}
 	
-	lambda res = shared<lambda_type>();
+	lambda res = make<lambda_type>();
 	
 	if( args->head.is<symbol>() ) {
 	  res->vararg = shared<symbol>(args->head.as<symbol>());
@@ -260,7 +618,7 @@ namespace lisp {
 	  }
 	  
 	  for(list it = sub; it; it = it->tail ) {
-		auto& s = it->head.as<symbol>();
+		const symbol s = it->head.as<symbol>();
 		
 		if( s == dot ) {
 		  // varargs
@@ -283,6 +641,203 @@ namespace lisp {
 	// body
 	res->body = args->tail->head;
 	
+	return res;
+  }
+
+
+  // lexical scopes during resolution, innermost last
+  using scope_chain = vec<const lambda_type*>;
+
+  static value resolve(const value& expr, scope_chain& scopes);
+  
+
+  void definitions(const value& e, vec<symbol>& names) {
+	if( !e.is<list>() || !e.as<list>() ) return;
+
+	const list& self = e.as<list>();
+
+	if( self->head.is<symbol>() ) {
+	  const symbol& s = self->head.as<symbol>();
+
+	  if( s == keyword.quote || s == keyword.lambda || s == keyword.fn ||
+		  s == keyword.defmacro ) {
+		return;
+	  }
+
+	  if( s == keyword.define && self->tail && self->tail->head.is<symbol>() ) {
+		const symbol& name = self->tail->head.as<symbol>();
+
+		if( std::find(names.begin(), names.end(), name) == names.end() ) {
+		  names.push_back(name);
+		}
+	  }
+	}
+
+	for(const value& x : self) {
+	  definitions(x, names);
+	}
+  }
+
+
+  // whether frames for a resolved lambda body may outlive their call:
+  // nested lambdas close over the frame, and so may macros defined or
+  // expanded at run time. builtins never keep their environment
+  static bool frame_escapes(const value& e) {
+	if( e.is<lambda>() ) return true;
+	if( !e.is<list>() || !e.as<list>() ) return false;
+
+	const list& self = e.as<list>();
+
+	if( self->head.is<symbol>() ) {
+	  const symbol& s = self->head.as<symbol>();
+
+	  if( s == keyword.quote ) return false;
+	  
+	  if( s == keyword.lambda || s == keyword.fn || s == keyword.defmacro || is_macro(s) ) {
+		return true;
+	  }
+	} else if( self->head.is<address>() && is_macro(self->head.as<address>()->name) ) {
+	  return true;
+	}
+
+	for(const value& x : self) {
+	  if( frame_escapes(x) ) return true;
+	}
+	
+	return false;
+  }
+  
+
+  // whether name appears anywhere in a resolved body, quoted or not
+  static bool mentions(const value& e, symbol name) {
+	if( e.is<symbol>() ) return e.as<symbol>() == name;
+	if( e.is<address>() ) return e.as<address>()->name == name;
+	if( e.is<lambda>() ) return mentions(e.as<lambda>()->body, name);
+	if( !e.is<list>() ) return false;
+
+	for(const value& x : e.as<list>()) {
+	  if( mentions(x, name) ) return true;
+	}
+
+	return false;
+  }
+  
+
+  static void resolve_body(lambda_type& self, scope_chain& scopes) {
+	definitions(self.body, self.defs);
+	
+	scopes.push_back(&self);
+	self.body = resolve(self.body, scopes);
+	scopes.pop_back();
+
+	self.escapes = frame_escapes(self.body);
+	self.rest = self.vararg && (self.escapes || mentions(self.body, *self.vararg));
+  }
+
+  
+  // frame variables become addresses, variables defined in some
+  // enclosing lambda body are looked up by name, the rest are globals
+  static value resolve_symbol(symbol s, const scope_chain& scopes) {
+	std::uint32_t depth = 0;
+	
+	for(auto it = scopes.rbegin(), end = scopes.rend(); it != end; ++it, ++depth) {
+	  const lambda_type* self = *it;
+
+	  auto arg = std::find(self->args.begin(), self->args.end(), s);
+	  if( arg != self->args.end() ) {
+		return make<address_type>(s, depth, std::uint32_t(arg - self->args.begin()));
+	  }
+	  
+	  if( self->vararg && *self->vararg == s ) {
+		return make<address_type>(s, depth, std::uint32_t(self->args.size()));
+	  }
+
+	  if( std::find(self->defs.begin(), self->defs.end(), s) != self->defs.end() ) {
+		return s;
+	  }
+	}
+
+	return make<address_type>(s, depth, address_type::global);
+  }
+
+  
+  // resolve elements of x, keeping the first n as they are
+  static list resolve_tail(const list& x, unsigned n, scope_chain& scopes) {
+	vec<value> res;
+
+	for(const value& xi : x) {
+	  res.push_back( n ? xi : resolve(xi, scopes) );
+	  if( n ) --n;
+	}
+
+	return make_list(res.begin(), res.end());
+  }
+
+  
+  static value resolve(const value& expr, scope_chain& scopes) {
+	if( expr.is<symbol>() ) return resolve_symbol(expr.as<symbol>(), scopes);
+	
+	if( !expr.is<list>() || !expr.as<list>() ) return expr;
+
+	const list& self = expr.as<list>();
+	
+	if( self->head.is<symbol>() ) {
+	  const symbol& s = self->head.as<symbol>();
+
+	  if( s == keyword.quote || s == keyword.defmacro ) return expr;
+
+	  if( s == keyword.lambda || s == keyword.fn ) {
+		// syntax errors are reported on evaluation
+		lambda res;
+		try {
+		  res = make_lambda(self->tail);
+		} catch( error& ) {
+		  return expr;
+		}
+
+		resolve_body(*res, scopes);
+		return res;
+	  }
+
+	  if( s == keyword.define ) {
+		const list res = resolve_tail(self, 2, scopes);
+
+		// name lambda templates after their variable
+		if( length(res) == 3 && res->tail->head.is<symbol>() && at(res, 2).is<lambda>() ) {
+		  at(res, 2).as<lambda>()->name = res->tail->head.as<symbol>();
+		}
+
+		return res;
+	  }
+	  
+	  if( s == keyword.cond ) {
+		vec<value> clauses = { s };
+		
+		for(const value& c : self->tail) {
+		  clauses.push_back( c.is<list>() ? resolve_tail(c.as<list>(), 0, scopes) : c );
+		}
+		
+		return make_list(clauses.begin(), clauses.end());
+	  }
+	  
+	  if( special.find(s) != special.end() ) return resolve_tail(self, 1, scopes);
+
+	  // unexpanded macro calls are left for evaluation
+	  if( is_macro(s) ) return expr;
+	}
+
+	return resolve_tail(self, 0, scopes);
+  }
+  
+  
+  static value eval_lambda(environment& env, const list& args, tail_call&) {
+	lambda res = make_lambda(args);
+
+	res->body = expand(env, res->body);
+	
+	scope_chain scopes = env->scopes();
+	resolve_body(*res, scopes);
+	
 	// environment
 	res->env = env;
 
@@ -300,7 +855,7 @@ namespace lisp {
 	}
 
 	value operator()(const std::string& self) const {
-	  return shared<std::string>(self);
+	  return make<string_type>(std::string(self));
 	}
 
 	value operator()(const sexpr::list& self) const {
@@ -309,9 +864,30 @@ namespace lisp {
 
 	template<class Iterator>
 	value operator()(Iterator first, Iterator last) const {
-	  if( first == last ) return list(nullptr);
-	  else return shared<cons>(first->template apply<value>(*this),
-							   (*this)(first + 1, last).template as<list>());
+	  vec<value> res;
+	  res.reserve( std::distance(first, last) );
+	  
+	  for(Iterator it = first; it != last; ++it) {
+		res.push_back( it->template apply<value>(*this) );
+	  }
+	  
+	  return make_list(res.begin(), res.end());
+	}
+
+	// compact parse trees
+	value operator()(const sexpr::text& self) const {
+	  return make<string_type>(std::string(self));
+	}
+	
+	value operator()(const sexpr::range& self) const {
+	  vec<value> res;
+	  res.reserve( self.size() );
+	  
+	  for(const sexpr::node& x : self) {
+		res.push_back( x.apply<value>(*this) );
+	  }
+	  
+	  return make_list(res.begin(), res.end());
 	}
 	
   };
@@ -320,10 +896,14 @@ namespace lisp {
   value convert(const sexpr::expr& expr) {
 	return expr.apply<value>(to_value());
   }
+
+  value convert(const sexpr::node& expr) {
+	return expr.apply<value>(to_value());
+  }
   
   
   
-  static inline value eval_quote(environment&, const list& args) {
+  static inline value eval_quote(environment&, const list& args, tail_call&) {
 	const unsigned argc = length(args);
 	
 	if(argc != 1) {
@@ -334,7 +914,7 @@ namespace lisp {
   }
   
   
-  static inline value eval_cond(environment& env, const list& args) {
+  static inline value eval_cond(environment& env, const list& args, tail_call& tail) {
 
 	for(const auto& it : args ) {
 	  if(!it.is<list>() || length(it.as<list>()) != 2 ) {
@@ -351,7 +931,10 @@ namespace lisp {
 	  // only false evaluates to false
 	  const bool fail = (res.is<bool>() && !res.as<bool>());
 
-	  if(!fail) return eval(env, cond->tail->head);
+	  if(!fail) {
+		tail.expr = cond->tail->head;
+		return {};
+	  }
 	}
 	
 	return null;
@@ -359,37 +942,54 @@ namespace lisp {
 
   
   
-  static inline value eval_begin(environment& env, const list& args) {
-	value res = null;
-
-	for(const auto& x: args) {
-	  res = eval(env, x);
+  static inline value eval_begin(environment& env, const list& args, tail_call& tail) {
+	if( !args ) return null;
+	
+	list it = args;
+	for(; it->tail; it = it->tail) {
+	  eval(env, it->head);
 	}
 	
-	return res;
+	tail.expr = it->head;
+	return {};
   }
 
   
 
-  static inline value eval_defmacro(environment& env, const list& args) {
+  static inline value eval_defmacro(environment& env, const list& args, tail_call& tail) {
 	const unsigned argc = length(args);
 	
 	if( argc != 3 ) throw error("bad defmacro syntax");
 
 	if( !args->head.is<symbol>() ) throw error("symbol expected for macro name");
+
+	const symbol name = args->head.as<symbol>();
+	if( is_macro(name) || autoload_macro(name) ) autoload_all();
 	
-	macro[ args->head.as<symbol>() ] = eval_lambda( env, args->tail ).as<lambda>();
+	macro[name] = eval_lambda( env, args->tail, tail ).as<lambda>();
 	
 	return null;
   };
 
   
   
-  static inline value eval_set(environment& env, const list& args) {
+  static inline value eval_set(environment& env, const list& args, tail_call&) {
 	const unsigned argc = length( args );
 	
 	if( argc != 2 ) throw error("bad set! syntax");
 
+	if( args->head.is<address>() ) {
+	  const address& a = args->head.as<address>();
+	  
+	  auto& var = env->find(a, [a] {
+		  throw error("unknown variable " + std::string(a->name.name()));
+		});
+	  
+	  var = eval(env, args->tail->head);
+	  if( a->index == address_type::global ) ++environment_type::epoch;
+	  return null;
+	}
+	
 	if( !args->head.is<symbol>() ) throw error("variable name expected");
 
 	const auto& s = args->head.as<symbol>();
@@ -399,6 +999,7 @@ namespace lisp {
 	  });
 
 	var = eval(env, args->tail->head);
+	++environment_type::epoch;
 	return null;
   }
   
@@ -439,6 +1040,14 @@ namespace lisp {
 	 out << "#<builtin>";
 	}
 
+	void operator()(const closure&, std::ostream& out ) const {
+	  out << "#<lambda>";
+	}
+
+	void operator()(const address& self, std::ostream& out ) const {
+	  out << self->name;
+	}
+
 	void operator()(const object& obj, std::ostream& out ) const {
 	  out << "#<" << obj->type << ">";
 	}
@@ -461,10 +1070,26 @@ namespace lisp {
 		depth = 1 + fun(*env.parent);
 	  }
 
-	  for(const auto& it : env) {
+	  const auto indent = [&] {
 		for(int i = 0; i < depth; ++i) {
 		  out << "  ";
 		}
+	  };
+	  
+	  if( env.self ) {
+		for(std::size_t i = 0, n = env.self->args.size(); i < n; ++i) {
+		  indent();
+		  out << env.self->args[i] << ": " << env.slots[i] << '\n';
+		}
+
+		if( env.self->vararg ) {
+		  indent();
+		  out << *env.self->vararg << ": " << env.slots.back() << '\n';
+		}
+	  }
+	  
+	  for(const auto& it : env) {
+		indent();
 		out << it.first << ": " <<  it.second << '\n';
 	  }
 	  
@@ -482,10 +1107,311 @@ namespace lisp {
   }
 
 
+  value* environment_type::slot(symbol name) {
+	auto it = std::find(self->args.begin(), self->args.end(), name);
+	if( it != self->args.end() ) return &slots[it - self->args.begin()];
+
+	if( self->vararg && *self->vararg == name ) return &slots.back();
+
+	return nullptr;
+  }
+
+  
+  void environment_type::define(symbol name, const value& x) {
+	if( self ) {
+	  if( value* res = slot(name) ) {
+		*res = x;
+		return;
+	  }
+	}
+
+	(*this)[name] = x;
+  }
+
+  
+  vec<const lambda_type*> environment_type::scopes() const {
+	vec<const lambda_type*> res;
+	
+	for(const environment_type* env = this; env && env->self; env = env->parent.get()) {
+	  res.push_back(env->self.get());
+	}
+
+	std::reverse(res.begin(), res.end());
+	return res;
+  }
+  
+  
+  environment_type* environment_type::root() {
+	environment_type* res = this;
+	while( res->parent ) res = res->parent.get();
+	return res;
+  }
+
+
+  std::size_t environment_type::epoch = 0;
+  
+  constexpr std::uint32_t address_type::global;
+
+  
+  // cons cells are carved from large chunks and recycled through a free
+  // list. chunks are never given back
+  struct slab_type {
+	static const std::size_t chunk_size = 1 << 12;
+
+	union cell {
+	  cell* next;
+	  alignas(cons) char data[sizeof(cons)];
+	};
+	
+	static_assert( sizeof(cell) == sizeof(cons), "cells must be contiguous" );
+	
+	cell* free = nullptr;
+	cell* ptr = nullptr;
+	cell* end = nullptr;
+
+	cell* chunk(std::size_t n) {
+	  cell* res = static_cast<cell*>( std::malloc(n * sizeof(cell)) );
+	  if( !res ) throw std::bad_alloc();
+	  return res;
+	}
+	
+	cell* allocate(std::size_t n) {
+	  // large blocks get their own chunk
+	  if( n > chunk_size / 4 ) return chunk(n);
+
+	  if( std::size_t(end - ptr) < n ) {
+		// recycle the rest of the current chunk
+		while( ptr != end ) release(ptr++);
+		
+		ptr = chunk(chunk_size);
+		end = ptr + chunk_size;
+	  }
+	  
+	  cell* res = ptr;
+	  ptr += n;
+	  return res;
+	}
+
+	void release(cell* x) {
+	  x->next = free;
+	  free = x;
+	}
+	
+  };
+
+  static slab_type slab;
+
+
+  void* cons::operator new(std::size_t size) {
+	assert( size == sizeof(cons) ); (void) size;
+	
+	if( slab.free ) {
+	  void* res = slab.free;
+	  slab.free = slab.free->next;
+	  return res;
+	}
+
+	return slab.allocate(1);
+  }
+
+
+  void cons::operator delete(void* ptr) {
+	slab.release(static_cast<slab_type::cell*>(ptr));
+  }
+
+
+  cons* cons::allocate(std::size_t n) {
+	return reinterpret_cast<cons*>( slab.allocate(n) );
+  }
+  
+  
+  template<class T>
+  static inline void free(void* ptr, tag type) {
+	T* obj = static_cast<T*>(ptr);
+	gc::untrack(obj, type, sizeof(T));
+	delete obj;
+  }
+  
+  
+  void value::destroy(std::uint64_t bits) {
+	void* ptr = reinterpret_cast<void*>(bits & payload_mask);
+	
+	switch( bits >> 48 ) {
+	case list_tag: {
+	  // unlink tails so that long lists are freed without recursion
+	  cons* x = static_cast<cons*>(ptr);
+	  while( x ) {
+		cons* next = x->tail.get();
+		x->tail.bits = box(list_tag, 0);
+		free<cons>(x, list_tag);
+
+		x = (next && --next->refs == 0) ? next : nullptr;
+	  }
+	  break;
+	}
+	case string_tag: free<string_type>(ptr, string_tag); break;
+	case lambda_tag: free<lambda_type>(ptr, lambda_tag); break;
+	case environment_tag: environment_type::release(static_cast<environment_type*>(ptr)); break;
+	case object_tag: free<object_type>(ptr, object_tag); break;
+	case closure_tag: free<closure_type>(ptr, closure_tag); break;
+	case address_tag: free<address_type>(ptr, address_tag); break;
+	default:
+	  assert(false && "not a heap value");
+	}
+  }
+
+  
+  // frames that cannot escape are not part of any cycle, so they are not
+  // tracked. calls and returns release them in stack order
+  static vec<environment_type*>& frame_stack() {
+	static vec<environment_type*>* res = new vec<environment_type*>;
+	return *res;
+  }
+
+  static constexpr std::size_t frame_stack_limit = 1024;
+  
+  static call_stats frame_counts;
+
+  const call_stats& frame_stats() {
+	return frame_counts;
+  }
+
+  
+  environment environment_type::frame(const lambda& self) {
+	++frame_counts.frames;
+	if( self->escapes ) return make<environment_type>(self);
+
+	++frame_counts.stack;
+	environment res = frame(self->env, self->args.size() + bool(self->vararg), false);
+	res->self = self;
+	
+	return res;
+  }
+
+
+  environment environment_type::frame(const environment& parent, std::size_t size, bool escapes) {
+	if( escapes ) {
+	  environment res = make<environment_type>(parent);
+	  res->slots.resize(size);
+	  return res;
+	}
+	
+	vec<environment_type*>& stack = frame_stack();
+	
+	if( stack.empty() ) {
+	  environment_type* res = new environment_type(parent);
+	  res->recycled = true;
+	  res->slots.resize(size);
+	  return environment(res);
+	}
+
+	environment_type* res = stack.back();
+	stack.pop_back();
+
+	res->parent = parent;
+	res->slots.resize(size);
+	
+	return environment(res);
+  }
+
+  
+  void environment_type::release(environment_type* env) {
+	if( !env->recycled ) return free<environment_type>(env, environment_tag);
+
+	vec<environment_type*>& stack = frame_stack();
+	if( stack.size() >= frame_stack_limit ) {
+	  delete env;
+	  return;
+	}
+
+	// may release other frames
+	env->parent = nullptr;
+	env->self = nullptr;
+	env->slots.clear();
+	env->clear();
+
+	stack.push_back(env);
+  }
+  
+  
   // this keeps gcc linker happy (??)
   lambda_type::lambda_type() { }
 
-  object_type::object_type(symbol type, std::initializer_list<value_type> list)
-	: unordered_map(list), type(type) { }	
+  object_type::object_type(symbol type)
+	: type(type), shape(shape_type::empty()) { }
+
+
+  shape_type::shape_type(const shape_type* parent, symbol name)
+	: names(parent->names) {
+	names.push_back(name);
+  }
+  
+  
+  const shape_type* shape_type::empty() {
+	static const shape_type* res = new shape_type;
+	return res;
+  }
+
+  
+  std::size_t shape_type::find(symbol name) const {
+	return std::find(names.begin(), names.end(), name) - names.begin();
+  }
+  
+
+  const shape_type* shape_type::add(symbol name) const {
+	assert( find(name) == size() );
+	
+	const shape_type*& res = transitions[name];
+	if( !res ) res = new shape_type(this, name);
+	
+	return res;
+  }
+
+
+  // direct-mapped cache of attribute offsets
+  struct offset_cache {
+	static const std::size_t size = 1 << 10;
+	
+	struct entry {
+	  const shape_type* shape = nullptr;
+	  symbol name;
+	  std::size_t offset = 0;
+	} table[size];
+	
+	std::size_t find(const shape_type* shape, symbol name) {
+	  const std::size_t h = (reinterpret_cast<std::size_t>(shape) >> 4) ^ std::hash<symbol>()(name);
+	  entry& e = table[h & (size - 1)];
+	  
+	  if( e.shape != shape || e.name != name ) {
+		e.shape = shape;
+		e.name = name;
+		e.offset = shape->find(name);
+	  }
+
+	  return e.offset;
+	}
+	
+  };
+
+  static offset_cache offsets;
+  
+  
+  value* object_type::find(symbol name) {
+	const std::size_t offset = offsets.find(shape, name);
+	return offset < slots.size() ? &slots[offset] : nullptr;
+  }
+
+  
+  void object_type::set(symbol name, const value& x) {
+	++version;
+	
+	if( value* res = find(name) ) {
+	  *res = x;
+	  return;
+	}
+
+	shape = shape->add(name);
+	slots.push_back(x);
+  }
 }
 
@@ -1,71 +1,438 @@
 #ifndef LISP_HPP
 #define LISP_HPP
 
-#include "variant.hpp"
 #include "sexpr.hpp"
 
 #include <map>
+#include <iterator>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <type_traits>
 #include <unordered_map>
 #include <initializer_list>
 
 namespace lisp {
 
   // values
-  struct value;
+  class value;
 
   using boolean = sexpr::boolean;
   using integer = sexpr::integer;
   using real = sexpr::real;
+
+  
+  // values are nan-boxed 64 bit words: reals are stored as is (with nans
+  // made canonical), everything else lives in the unused negative nan
+  // space as a 16 bit tag and a 48 bit payload. heap tags come last
+  enum tag : std::uint16_t {
+	undefined_tag = 0xfff1,
+	boolean_tag,
+	integer_tag,
+	symbol_tag,
+	builtin_tag,
+	
+	list_tag,
+	string_tag,
+	lambda_tag,
+	environment_tag,
+	object_tag,
+	closure_tag,
+	address_tag,
+  };
+
   
-  // wrap these to avoid too large value sizes
-  // TODO boost::intrusive_ptr instead of ref<> and make it 2 words  
-  using string = ref<sexpr::string>;
+  // intrusive, non-atomic reference count for heap values, and the
+  // position of the object in the collector generations. copies start
+  // unreferenced and untracked
+  struct header {
+	std::uint32_t refs = 0;
+	std::uint32_t index : 31;
+	std::uint32_t old : 1;
+	
+	header() : index(0), old(0) { }
+	header(const header& ) : header() { }
+	header& operator=(const header& ) { return *this; }
+  };
+
+
+  // cycle collector, see gc.cpp
+  namespace gc {
+
+	// heap objects are tracked when created and untracked when freed
+	void track(header* obj, tag type, std::size_t size);
+	void untrack(header* obj, tag type, std::size_t size);
+
+	// collect cyclic garbage, in the young generation only unless full
+	std::size_t collect(bool full);
+	
+	struct stats_type {
+	  std::size_t young = 0;		// young generation collections
+	  std::size_t full = 0;			// full collections
+	  std::size_t collected = 0;	// objects freed by the collector
+	  double pause = 0;				// total pause time (ms)
+	  double max_pause = 0;
+	  std::size_t live = 0;			// bytes in live heap objects
+	  std::size_t tracked = 0;		// objects that may form cycles
+	};
+
+	const stats_type& stats();
+  }
+
+  template<class T> struct heap_tag;
+  
+  // typed heap value
+  template<class T> class handle;
+  
+  
+  struct string_type;
+  using string = handle<string_type>;
 
   struct cons;
-  using list = ref< cons >;
+  using list = handle<cons>;
 
   struct lambda_type;
-  using lambda = ref<lambda_type>;
+  using lambda = handle<lambda_type>;
   
   class environment_type;
-  using environment = ref<environment_type>;
+  using environment = handle<environment_type>;
 
   using builtin = value (*)(environment& env, value* first, value* last);
 
   struct closure_type;
-  using closure = ref<closure_type>;
+  using closure = handle<closure_type>;
   
   struct object_type;
-  using object = ref<object_type>;
+  using object = handle<object_type>;
+
+  struct address_type;
+  using address = handle<address_type>;
+
+  template<> struct heap_tag<cons> { static constexpr tag value = list_tag; };
+  template<> struct heap_tag<string_type> { static constexpr tag value = string_tag; };
+  template<> struct heap_tag<lambda_type> { static constexpr tag value = lambda_tag; };
+  template<> struct heap_tag<environment_type> { static constexpr tag value = environment_tag; };
+  template<> struct heap_tag<object_type> { static constexpr tag value = object_tag; };
+  template<> struct heap_tag<closure_type> { static constexpr tag value = closure_tag; };
+  template<> struct heap_tag<address_type> { static constexpr tag value = address_tag; };
+
   
-  struct value : variant<boolean, integer, real, symbol, string, list, lambda, environment, builtin, object, closure> {
-	using variant::variant;
+  // tags and accessors for immediate types
+  template<class T> struct immediate;
+  
+  
+  class value {
+	static_assert( sizeof(void*) == sizeof(std::uint64_t), "64 bit pointers needed");
+	
+	static constexpr std::uint64_t payload_mask = (std::uint64_t(1) << 48) - 1;
+	static constexpr std::uint64_t canonical_nan = 0x7ff8000000000000ul;
+
+	static constexpr std::uint64_t box(tag t, std::uint64_t payload) {
+	  return (std::uint64_t(t) << 48) | payload;
+	}
+
+	template<class T> friend struct immediate;
+	template<class T> friend class handle;
+	friend class collector;
+
+	// frees heap values when their count drops to zero
+	static void destroy(std::uint64_t bits);
+	
+	inline bool heap() const {
+	  return (bits >> 48) >= list_tag && (bits & payload_mask);
+	}
+
+	inline header* counted() const {
+	  return reinterpret_cast<header*>(bits & payload_mask);
+	}
+	
+	inline void retain() const {
+	  if( heap() ) ++counted()->refs;
+	}
+
+	inline void release() const {
+	  if( heap() && --counted()->refs == 0 ) destroy(bits);
+	}
+
+  protected:
+	std::uint64_t bits;
+
+	explicit value(tag t, const void* ptr)
+	  : bits( box(t, reinterpret_cast<std::uint64_t>(ptr)) ) {
+	  retain();
+	}
+	
+	inline void* pointer() const {
+	  return reinterpret_cast<void*>(bits & payload_mask);
+	}
+	
+  public:
+	
+	value() : bits( box(undefined_tag, 0) ) { }
+
+	template<class B, class = typename std::enable_if< std::is_same<B, boolean>::value >::type>
+	value(B x) : bits( box(boolean_tag, x) ) { }
+	
+	value(integer x) : bits( box(integer_tag, std::uint32_t(x)) ) { }
+
+	value(real x) {
+	  if( x != x ) bits = canonical_nan;
+	  else std::memcpy(&bits, &x, sizeof(x));
+	}
+	
+	value(symbol x) : bits( box(symbol_tag, reinterpret_cast<std::uint64_t>(x.name())) ) { }
+	value(builtin x) : bits( box(builtin_tag, reinterpret_cast<std::uint64_t>(x)) ) { }
+
+	// would silently convert to boolean
+	value(const char* ) = delete;
+	
+	value(const value& other) : bits(other.bits) { retain(); }
+	value(value&& other) noexcept : bits(other.bits) { other.bits = box(undefined_tag, 0); }
+
+	~value() { release(); }
+
+	value& operator=(const value& other) {
+	  // other may be owned by the object we release
+	  const std::uint64_t x = other.bits;
+	  other.retain();
+	  release();
+	  bits = x;
+	  return *this;
+	}
+
+	value& operator=(value&& other) noexcept {
+	  const std::uint64_t x = other.bits;
+	  other.bits = box(undefined_tag, 0);
+	  release();
+	  bits = x;
+	  return *this;
+	}
+
+	
+	template<class T>
+	inline bool is() const { return immediate<T>::is(bits); }
+	
+	template<class T>
+	inline auto as() const -> decltype( immediate<T>::get(*this) ) {
+	  assert( is<T>() && "cast error" );
+	  return immediate<T>::get(*this);
+	}
+
+	template<class T>
+	inline auto as() -> decltype( immediate<T>::get(*this) ) {
+	  assert( is<T>() && "cast error" );
+	  return immediate<T>::get(*this);
+	}
+	
+	template<class Ret = void, class F, class ... Args>
+	inline Ret apply(const F& f, Args&& ... args) const;
 
+	
+	explicit operator bool() const { return bits != box(undefined_tag, 0); }
+
+	// reals compare as numbers, the rest by identity
+	bool operator==(const value& other) const;
+	bool operator!=(const value& other) const { return !(*this == other); }
+	
 	friend std::ostream& operator<<(std::ostream& out, const value& );
   };
 
   // make sure we don't accidentally form too large value type
-  static_assert( sizeof(value) <= 3 * sizeof( void* ), "too big yo");
+  static_assert( sizeof(value) == sizeof( void* ), "too big yo");
+
+  
+  template<> struct immediate<boolean> {
+	static bool is(std::uint64_t bits) { return bits >> 48 == boolean_tag; }
+	static boolean get(const value& x) { return x.bits & 1; }
+  };
+
+  template<> struct immediate<integer> {
+	static bool is(std::uint64_t bits) { return bits >> 48 == integer_tag; }
+	static integer get(const value& x) { return integer(std::uint32_t(x.bits)); }
+  };
+
+  template<> struct immediate<real> {
+	static bool is(std::uint64_t bits) { return bits >> 48 <= 0xfff0; }
+	static real get(const value& x) {
+	  real res;
+	  std::memcpy(&res, &x.bits, sizeof(res));
+	  return res;
+	}
+  };
+
+  template<> struct immediate<symbol> {
+	static bool is(std::uint64_t bits) { return bits >> 48 == symbol_tag; }
+	static symbol get(const value& x) {
+	  return symbol::interned( static_cast<const char*>(x.pointer()) );
+	}
+  };
+
+  template<> struct immediate<builtin> {
+	static bool is(std::uint64_t bits) { return bits >> 48 == builtin_tag; }
+	static builtin get(const value& x) {
+	  return reinterpret_cast<builtin>(x.bits & value::payload_mask);
+	}
+  };
+
+  // heap values are values: casts are free
+  template<class T> struct immediate< handle<T> > {
+	static bool is(std::uint64_t bits) { return bits >> 48 == heap_tag<T>::value; }
+	static const handle<T>& get(const value& x) { return static_cast<const handle<T>&>(x); }
+	static handle<T>& get(value& x) { return static_cast<handle<T>&>(x); }
+  };
+
+  
+  template<class T>
+  class handle : public value {
+  public:
+	handle(std::nullptr_t = nullptr) : value(heap_tag<T>::value, nullptr) { }
+	explicit handle(T* ptr) : value(heap_tag<T>::value, ptr) { }
+
+	handle(const handle& ) = default;
+	handle(handle&& other) noexcept : value(heap_tag<T>::value, nullptr) {
+	  std::swap(bits, other.bits);
+	}
 
+	handle& operator=(const handle& ) = default;
+	handle& operator=(handle&& other) noexcept {
+	  std::swap(bits, other.bits);
+	  return *this;
+	}
+	
+	T* get() const { return static_cast<T*>(pointer()); }
+	T* operator->() const { return get(); }
+	// a template, so that list iteration below is preferred
+	template<class U = T>
+	U& operator*() const { return *get(); }
+
+	// null heap values are still values of their type
+	explicit operator bool() const { return pointer(); }
+	
+	bool operator==(const handle& other) const { return bits == other.bits; }
+	bool operator!=(const handle& other) const { return bits != other.bits; }
+
+	// no other references
+	bool unique() const { return get()->refs == 1; }
+  };
+
+
+  inline bool value::operator==(const value& other) const {
+	if( is<real>() && other.is<real>() ) return as<real>() == other.as<real>();
+	return bits == other.bits;
+  }
+
+  
+  template<class Ret, class F, class ... Args>
+  inline Ret value::apply(const F& f, Args&& ... args) const {
+	switch( bits >> 48 ) {
+	case undefined_tag: throw std::logic_error("undefined value");
+	case boolean_tag: return f(as<boolean>(), std::forward<Args>(args)...);
+	case integer_tag: return f(as<integer>(), std::forward<Args>(args)...);
+	case symbol_tag: return f(as<symbol>(), std::forward<Args>(args)...);
+	case builtin_tag: return f(as<builtin>(), std::forward<Args>(args)...);
+	case list_tag: return f(as<list>(), std::forward<Args>(args)...);
+	case string_tag: return f(as<string>(), std::forward<Args>(args)...);
+	case lambda_tag: return f(as<lambda>(), std::forward<Args>(args)...);
+	case environment_tag: return f(as<environment>(), std::forward<Args>(args)...);
+	case object_tag: return f(as<object>(), std::forward<Args>(args)...);
+	case closure_tag: return f(as<closure>(), std::forward<Args>(args)...);
+	case address_tag: return f(as<address>(), std::forward<Args>(args)...);
+	default: return f(as<real>(), std::forward<Args>(args)...);
+	}
+  }
+
+
+  // take ownership of a newly constructed heap object
+  template<class T>
+  static inline handle<T> manage(T* ptr) {
+	handle<T> res(ptr);
+
+	// may collect: res is referenced by now
+	gc::track(ptr, heap_tag<T>::value, sizeof(T));
+	return res;
+  }
+  
+  template<class T, class ... Args>
+  static inline handle<T> make(Args&& ... args) {
+	return manage( new T(std::forward<Args>(args)...) );
+  }
+
+  
   struct error : std::runtime_error {
 	using std::runtime_error::runtime_error;
 	std::string details;
   };
 
+
+  struct string_type : header, std::string {
+	using std::string::string;
+	string_type(const std::string& other) : std::string(other) { }
+  };
+
+  
+  // lexically resolved variable: skip depth frames, then read frame slot
+  // index. global addresses look name up in the hashed environment found
+  // there instead
+  struct address_type : header {
+	symbol name;
+	std::uint32_t depth;
+	std::uint32_t index;
+
+	static constexpr std::uint32_t global = -1;
+
+	address_type(symbol name, std::uint32_t depth, std::uint32_t index)
+	  : name(name), depth(depth), index(index) { }
+  };
+
   
-  class environment_type : public std::enable_shared_from_this<environment_type>,
+  // environments are either hashed (the global environment) or lambda
+  // call frames, where arguments live in fixed slots. variables defined
+  // inside lambda bodies go to the frame hash table
+  class environment_type : public header,
 						   protected std::unordered_map<symbol, value> {
 	environment parent;
+
+	// lambda this frame was created for, null for hashed environments
+	lambda self;
+
+	// untracked frame, recycled once released
+	bool recycled = false;
+
+	friend class image_writer;
+	friend class image_reader;
+
+	// frame slot for name, if any
+	value* slot(symbol name);
+	
   public:
 
+	// frame variables: lambda arguments, then rest argument
+	vec<value> slots;
+
+	// bumped by every write to a hashed environment, so that caches of
+	// global bindings can tell when they are stale
+	static std::size_t epoch;
+	
 	environment_type(environment parent = nullptr) : parent(parent) { }
+	explicit environment_type(const lambda& self);
+
+	// call frame for self. frames that cannot escape their call come from
+	// a stack of released frames instead of the heap
+	static environment frame(const lambda& self);
+
+	// call frame with size slots, for code that is not a lambda
+	static environment frame(const environment& parent, std::size_t size, bool escapes);
+
+	// free or recycle an environment without references
+	static void release(environment_type* env);
 
 	template<class SIterator, class VIterator>
 	environment augment(SIterator sfirst, SIterator slast,
 						VIterator vfirst, VIterator vlast) {
 	  assert( slast - sfirst == vlast - vfirst );
 	  
-	  environment res = std::make_shared<environment_type>( shared_from_this() );
+	  environment res = make<environment_type>( environment(this) );
 	  
 	  for(; sfirst != slast && vfirst != vlast; ++sfirst, ++vfirst) {
 		res->insert( {*sfirst, *vfirst} );
@@ -83,13 +450,21 @@ namespace lisp {
 	// TODO rename 
 	template<class Fail>
 	inline mapped_type& find(key_type key, Fail&& fail = {} ) {
-	  
-	  auto it = base::find(key);
-	  if( it != end() ) {
-		return it->second;
+
+	  if( !empty() ) {
+		auto it = base::find(key);
+		if( it != end() ) {
+		  return it->second;
+		}
 	  }
 
+	  if( self ) {
+		if( value* res = slot(key) ) return *res;
+	  }
+	  
 	  if( !parent ) {
+		if( autoload(key) ) return find(key, std::forward<Fail>(fail));
+		
 		fail();
 		throw key_error();
 	  }
@@ -98,34 +473,140 @@ namespace lisp {
 	}
 
 
+	// variable bound in this hashed environment, without autoloading. null
+	// when there is none
+	inline const value* binding(key_type key) const {
+	  auto it = base::find(key);
+	  return it != end() ? &it->second : nullptr;
+	}
+	
+
+	// resolved variable lookup
+	template<class Fail>
+	inline mapped_type& find(const address& addr, Fail&& fail = {} ) {
+	  environment_type* env = this;
+	  
+	  for(std::uint32_t i = 0; i < addr->depth; ++i) {
+		env = env->parent.get();
+	  }
+
+	  if( addr->index != address_type::global ) {
+		return env->slots[addr->index];
+	  }
+	  
+	  return env->find(addr->name, std::forward<Fail>(fail));
+	}
+
+	
+	// define variable in this environment
+	void define(symbol name, const value& x);
+
+	// evaluate the pending autoloaded definition of name in this
+	// environment, if any (see autoload.cpp)
+	bool autoload(symbol name);
+
+	// variable, pending definitions of name are evaluated first so that
+	// the new value overrides them
+	mapped_type& operator[](key_type key);
+
+	// references to other values, for the collector
+	template<class F>
+	void trace(F&& f) {
+	  f(parent);
+	  f(self);
+	  for(value& x : slots) f(x);
+	  for(auto& it : *this) f(it.second);
+	}
+	
+	// lambdas for the enclosing frames, outermost first
+	vec<const lambda_type*> scopes() const;
+
+	// outermost environment, holding the global bindings
+	environment_type* root();
+
+	// enclosing environment, null for the outermost one
+	environment_type* outer() const { return parent.get(); }
 	
-	using environment_type::base::operator[];
 	using environment_type::base::insert;
 	
 	friend std::ostream& operator<<(std::ostream& out, const environment_type& env);
   };
 
   
-  struct lambda_type {
+  // native code tier for hot lambdas, see native.cpp
+  namespace native {
+	struct code_type;
+
+	// lambdas are compiled after this many calls
+	static constexpr std::uint32_t threshold = 1000;
+
+	// set the code for self if its body can be compiled
+	void compile(const lambda& self);
+	
+	// run the code for self unless some guard fails, in which case the
+	// call is left to the interpreter
+	bool call(const lambda& self, value* first, value* last, value& res);
+  }
+  
+  
+  // lambda expressions are resolved once into lambdas with a null
+  // environment, which evaluate to closures over the current environment
+  struct lambda_type : header {
 	lambda_type();
    
 	environment env;
 	vec<symbol> args;
 	ref<symbol> vararg;
 	value body;
+
+	// variables defined in body
+	vec<symbol> defs;
+
+	// name of the variable it was first defined as, if any
+	symbol name;
+
+	// frames may outlive calls, see frame_escapes
+	bool escapes = true;
+
+	// calls build the rest argument list, which unused varargs skip
+	bool rest = true;
+
+	// calls left until compilation, and native code once hot
+	std::uint32_t countdown = native::threshold;
+	ref<native::code_type> code;
+	
+	template<class F>
+	void trace(F&& f) {
+	  f(env);
+	  f(body);
+	}
   };
+
+
+  inline environment_type::environment_type(const lambda& self)
+	: parent(self->env),
+	  self(self),
+	  slots(self->args.size() + bool(self->vararg)) { }
   
 
-  struct closure_type {
+  struct closure_type : header {
 	ref<void> data;
 	value (*func)(environment& env, void* data, value* first, value* last) = nullptr;
 
+	// (builtin args...) call that builds the closure again, for heap
+	// images. closures without one cannot be saved
+	list source;
+
+	// environment captured by data, if any. data only points to it, so
+	// that the collector sees cycles through the closure
+	environment env;
+	
 	closure_type() { };
 
 	template<class F>
 	closure_type(F&& f) {
 
-	  data = std::make_shared<F>(std::forward(f));
+	  data = std::make_shared< typename std::decay<F>::type >(std::forward<F>(f));
 	  func = [](environment& env, void* data, value* first, value* last) {
 		using func_type = typename std::decay<F>::type;
 		return reinterpret_cast< func_type* >(data)->operator()(env, first, last);
@@ -133,19 +614,68 @@ namespace lisp {
 	  
 	};
 
+
+	template<class F>
+	void trace(F&& f) {
+	  f(env);
+	}
   };
 
   
   
+  // object layouts form a shared transition tree from the empty shape,
+  // one attribute at a time, so that objects built alike share their
+  // shape. shapes are never freed
+  class shape_type {
+	vec<symbol> names;
+	mutable std::unordered_map<symbol, const shape_type*> transitions;
+
+	shape_type() = default;
+	shape_type(const shape_type* parent, symbol name);
+	
+  public:
+	static const shape_type* empty();
+	
+	std::size_t size() const { return names.size(); }
+	symbol name(std::size_t i) const { return names[i]; }
+	
+	// attribute offset, size() if absent
+	std::size_t find(symbol name) const;
+
+	// shape with an extra attribute
+	const shape_type* add(symbol name) const;
+  };
+
+  
   // testing stuff
-  struct object_type : std::unordered_map< symbol, value > {
+  struct object_type : header {
 	symbol type;
-	object_type(symbol type = "object", std::initializer_list<value_type> list = {});
+	const shape_type* shape;
+	vec<value> slots;
+
+	// bumped by set, so that caches of attribute values can tell when
+	// they are stale
+	std::uint32_t version = 0;
+	
+	object_type(symbol type = "object");
+
+	// attribute value, nullptr if absent. offsets are cached by (shape,
+	// name) so that accesses on objects built alike skip the lookup
+	value* find(symbol name);
+
+	// define or update attribute
+	void set(symbol name, const value& x);
+	
+	template<class F>
+	void trace(F&& f) {
+	  for(value& x : slots) f(x);
+	}
   };
 
   
   // build a value from a pure symbolic expression
   value convert(const sexpr::expr& expr);
+  value convert(const sexpr::node& expr);
   
   // evaluate expression
   value eval(environment& env, const value& expr);
@@ -153,46 +683,198 @@ namespace lisp {
   // apply expr to (evaluated) args
   value apply(environment& env, const value& expr, value* arg, value* end);
 
+  // expand all macro calls in expr, leaving quoted data alone. calls
+  // that fail to expand are left as they are
+  value expand(environment& env, const value& expr);
+  bool is_macro(symbol name);
+
+  // variables defined in an expanded lambda body, added to names in
+  // order. both evaluators lay frames out this way
+  void definitions(const value& body, vec<symbol>& names);
+
+  // macro table
+  std::map<symbol, lambda>& macros();
+
+  // calls to name are passed to rewrite once their arguments are
+  // expanded, e.g. to fuse list operations (see builtin.cpp). rewrites
+  // return the call unchanged when they do not apply
+  using rewrite = value (*)(const list& call);
+  void define_rewrite(symbol name, rewrite f);
+
+  // calls to head, as produced by some rewrite, are shown as f gives them
+  // back in error messages
+  void define_source(symbol head, rewrite f);
+
+
+  // prelude autoloading, see autoload.cpp
+  using evaluator = value (*)(environment& env, const value& expr);
+
+  // evaluate toplevel form in env the first time a name it defines is
+  // looked up there, or right away if it defines nothing
+  void autoload(environment& env, const value& form, evaluator eval);
+
+  // evaluate the pending definition of macro name, if any
+  bool autoload_macro(symbol name);
+
+  // evaluate all pending definitions
+  void autoload_all();
+
+  // macro calls are expanded once per call site
+  struct expansion_stats {
+	std::size_t expanded = 0;	// macro applications
+	std::size_t avoided = 0;	// expansions found in the call site cache
+  };
+
+  const expansion_stats& macro_stats();
+
+  // lambda call frames
+  struct call_stats {
+	std::size_t frames = 0;		// frames created
+	std::size_t stack = 0;		// frames that could not escape
+  };
+
+  const call_stats& frame_stats();
+
+
+  // lambda call profiler, see profile.cpp
+  namespace profile {
 
+	// evaluator hooks are skipped unless enabled
+	extern bool enabled;
 
-  // lists
-  struct cons {
+	// start profiling, sampling the lisp call stack every interval ms if
+	// positive
+	void start(double interval = 0);
+	void stop();
+
+	// per-lambda statistics, by decreasing exclusive time
+	struct entry {
+	  symbol name;
+	  std::size_t calls = 0;
+	  double inclusive = 0;		// ms, outermost activations only
+	  double exclusive = 0;		// ms
+	  std::size_t samples = 0;
+	};
+
+	vec<entry> report();
+
+	// one "outer;inner count" line per call stack, counting samples when
+	// sampling and exclusive microseconds otherwise
+	void collapsed(std::ostream& out);
+	
+	// shadow stack hooks: return a session id, calls made from a
+	// previous session are ignored
+	std::size_t enter(const lambda_type* self);
+	void replace(std::size_t session, const lambda_type* self);
+	void leave(std::size_t session);
+
+	// lambda activations in a single evaluation loop, replaced by tail
+	// calls and left on exit
+	class frame {
+	  std::size_t session = 0;
+	public:
+	  frame() = default;
+	  frame(const frame& ) = delete;
+	  
+	  void call(const lambda_type* self) {
+		if( session ) replace(session, self);
+		else session = enter(self);
+	  }
+	  
+	  ~frame() { if( session ) leave(session); }
+	};
+  }
+
+
+
+  // heap images, see image.cpp
+  namespace image {
+
+	// save a global environment and the macro table to path
+	void save(const environment& env, const std::string& path);
+
+	// global environment saved in path, restoring the macro table
+	environment load(const std::string& path);
+  }
+  
+
+  // lists. cells are immutable once built, so that each one knows the
+  // length of its list and how many of the following cells are stored
+  // right after it: lists built at once are contiguous and indexed in
+  // constant time
+  struct cons : header {
 	value head;
-	list tail = nullptr;
+	list tail;
+	std::uint32_t size;		// list length from this cell
+	std::uint32_t run;		// following cells stored contiguously
+	
+	cons(const value& head, list tail = nullptr)
+	  : head(head), tail(std::move(tail)) {
+	  const cons* next = this->tail.get();
+	  size = next ? next->size + 1 : 1;
+	  run = next == this + 1 ? next->run + 1 : 0;
+	}
+
+	// cells come from a slab allocator
+	static void* operator new(std::size_t size);
+	static void* operator new(std::size_t, void* ptr) { return ptr; }
+	static void operator delete(void* ptr);
+
+	// uninitialized storage for n contiguous cells, freed cell by cell
+	static cons* allocate(std::size_t n);
 
-	cons(const value& head, list tail = nullptr) : head(head), tail(tail) { }
+	template<class F>
+	void trace(F&& f) {
+	  f(head);
+	  f(tail);
+	}
 	
 	// range-based loops
 	friend inline list begin(list x) { return x; }
 	friend inline list end(list ) { return nullptr; }
 	friend inline list& operator++(list& x) { x = x->tail; return x; }
-	friend inline value& operator*(list x) { return x->head; };
+	friend inline value& operator*(const list& x) { return x->head; };
 
 	
-	friend inline unsigned length(list x) {
-	  if( !x ) return 0;
-	  else return 1 + length(x->tail);
+	friend inline unsigned length(const list& x) {
+	  return x ? x->size : 0;
 	}
 	
-	friend inline value& at(list x, unsigned n) {
-	  if( !n ) { 
-		assert(x);
-		return x->head;
-	  } else {
-		return at(x, n - 1);
+	friend inline value& at(const list& x, unsigned n) {
+	  assert( n < length(x) );
+	  cons* it = x.get();
+	  
+	  while( n ) {
+		if( it->run ) {
+		  const unsigned step = std::min(n, it->run);
+		  it += step;
+		  n -= step;
+		} else {
+		  it = it->tail.get();
+		  --n;
+		}
 	  }
+	  
+	  return it->head;
 	}
 	
   };
 
+  // contiguous list from a range, followed by tail
   template<class Iterator>
-  inline list make_list(Iterator first, Iterator last) {
-	if(first == last) {
-	  return nullptr;
-	} else {
-	  const value& head = *first;
-	  return std::make_shared<cons>(head, make_list(++first, last));
+  inline list make_list(Iterator first, Iterator last, list tail = nullptr) {
+	const std::size_t n = std::distance(first, last);
+	if( !n ) return tail;
+
+	cons* block = cons::allocate(n);
+	list res = std::move(tail);
+
+	// back to front, so that each cell sees its tail
+	for(std::size_t i = n; i-- > 0;) {
+	  res = manage( new (block + i) cons(*--last, std::move(res)) );
 	}
+	
+	return res;
   }
 
 
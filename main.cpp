@@ -5,10 +5,16 @@
 #include "repl.hpp"
 #include "parse.hpp"
 #include "syntax.hpp"
+#include "toplevel.hpp"
+#include "thread_pool.hpp"
+
+#include "lisp.hpp"
+#include "builtin.hpp"
+#include "vm.hpp"
 
 #include "code.hpp"
 
-#include <fstream>
+#include <cstring>
 
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/Analysis/Passes.h"
@@ -18,22 +24,34 @@
 
 
 struct sexpr_parser {
-  std::function< void (const sexpr::list& prog ) > handler;
+  std::function< void (form_reader& forms) > handler;
 
   void operator()( const char* line ) const {
-	std::stringstream ss(line);
-	(*this)(ss);
+	form_reader forms(line, line + std::strlen(line));
+	run(forms);
   }
   
   void operator()( std::istream& in) const {
+	form_reader forms(in);
+	run(forms);
+  }
+
+  // parse file through a memory mapping
+  void file( const std::string& path ) const {
+	form_reader forms = form_reader::file(path);
+	run(forms);
+  }
+
+private:
+  // forms are parsed as the handler pulls them
+  void run( form_reader& forms ) const {
 	try {
-	  const sexpr::list prog = parse(in);
-	  handler(prog);
+	  handler(forms);
 	} catch( parse_error& e ) {
 	  std::cerr << "parse error: " << e.what() << std::endl;
 	}
   }
-
+  
 };
 
 
@@ -155,6 +173,12 @@ struct hm_handler {
   mutable context ctx;
   mutable union_find<type::mono> types;
 
+  // cached toplevel definitions
+  mutable toplevel defs;
+
+  // parallel inference of independent definitions when set
+  std::shared_ptr<thread_pool> pool;
+
   struct type_check {
 
     type::poly operator()(const ast::expr& self, union_find<type::mono>& types, const context& ctx) const {
@@ -225,7 +249,7 @@ struct hm_handler {
 		  args.push_back( fresh );
 		}
 
-		type::mono t = std::make_shared<type::app_type>(func, args);
+		type::mono t = type::app(func, args);
 
 		// TODO what if constructors take constant types as args ?
 		// TODO need to expose type constants
@@ -609,17 +633,117 @@ struct hm_handler {
   
   
   
-  void operator()(const sexpr::list& prog) const {
-	try {
-	  for(const sexpr::expr& s : prog ) {
-		const ast::node e = transform( s );
-		type::poly p = e.apply<type::poly>(type_check(), types, ctx);
+  void sequential(form_reader& forms) const {
+	sexpr::arena storage;
+	
+	for(sexpr::node s; forms.next(storage, s); storage.clear()) {
+	  const ast::node e = transform( s );
 
-		{
-		  e.apply( codegen{*jit}, p);
+	  // unchanged definitions keep their type and value
+	  if( e.is<ast::def>() ) {
+		auto& self = e.as<ast::def>();
+		  
+		if( const type::poly* p = defs.find(self.id, s) ) {
+		  ctx.set(self.id, *p);
+		  std::cout << self.id << " :: " << *p << std::endl;
+		  continue;
 		}
 	  }
+		
+	  type::poly p = e.apply<type::poly>(type_check(), types, ctx);
+
+	  if( e.is<ast::def>() ) {
+		defs.update(e.as<ast::def>(), s, p);
+	  }
+		
+	  {
+		e.apply( codegen{*jit}, p);
+	  }
+	}
+  }
+
+
+  void parallel(const vec<sexpr::node>& prog) const {
+	vec<ast::node> nodes;
+	nodes.reserve( prog.size() );
+	
+	for(const sexpr::node& s : prog ) {
+	  nodes.push_back( transform(s) );
+	}
+
+	for(std::size_t i = 0, n = nodes.size(); i < n; ) {
+
+	  // datatype declarations are processed in order
+	  if( nodes[i].is<ast::type>() ) {
+		type::poly p = nodes[i].apply<type::poly>(type_check(), types, ctx);
+		nodes[i].apply( codegen{*jit}, p);
+		++i;
+		continue;
+	  }
+
+	  // infer definitions/expressions up to the next declaration
+	  std::size_t j = i;
+	  while( j < n && !nodes[j].is<ast::type>() ) ++j;
+
+	  const auto res = defs.infer(prog.data() + i, nodes.data() + i, j - i, ctx, types, *pool);
+
+	  // report and generate code in program order
+	  for(std::size_t k = i; k < j; ++k) {
+		const toplevel::result& r = res[k - i];
+		if( r.error ) std::rethrow_exception(r.error);
+
+		if( nodes[k].is<ast::def>() ) std::cout << nodes[k].as<ast::def>().id;
+		std::cout << " :: " << r.type << std::endl;
+		
+		nodes[k].apply( codegen{*jit}, r.type);
+	  }
+
+	  i = j;
+	}
+  }
+
+  
+  // forms are read and inferred in batches of bounded size
+  static constexpr std::size_t batch = 1024;
+  
+  void parallel(form_reader& forms) const {
+	sexpr::arena storage;
+	
+	vec<sexpr::node> prog;
+	prog.reserve(batch);
+
+	sexpr::node s;
+	for(bool more = true; more; ) {
+	  prog.clear();
+	  storage.clear();
+
+	  // forms before a parse error are still processed
+	  std::exception_ptr error;
+	  try {
+		while( prog.size() < batch && (more = forms.next(storage, s)) ) {
+		  prog.push_back(s);
+		}
+	  } catch( parse_error& ) {
+		error = std::current_exception();
+		more = false;
+	  }
+	  
+	  parallel(prog);
+	  if( error ) std::rethrow_exception(error);
+	}
+  }
+  
+  
+  void operator()(form_reader& forms) const {
+	defs.reload();
+	
+	try {
+	  if( pool ) parallel(forms);
+	  else sequential(forms);
 	}	
+	catch( parse_error& e ) {
+	  std::cerr << "parse error: " << e.what() << std::endl;
+	}
 	catch( syntax_error& e ) {
 	  std::cerr << "syntax error: " << e.what() << std::endl;
 	}
@@ -800,20 +924,137 @@ struct hm_handler {
   
 
 
+struct lisp_handler {
+  mutable lisp::environment env;
+
+  // bytecode machine instead of the reference evaluator
+  bool vm;
+  
+  // start from a heap image instead of init.lisp, if any
+  lisp_handler(bool vm, const std::string& image = {})
+	: vm(vm) {
+
+	if( !image.empty() ) {
+	  env = lisp::image::load(image);
+	  return;
+	}
+	
+	env = lisp::make<lisp::environment_type>();
+	lisp::builtins(env);
+
+	// prelude definitions are evaluated when first used
+	try {
+	  form_reader prelude = form_reader::file("init.lisp");
+	  sexpr::arena storage;
+	  
+	  for(sexpr::node e; prelude.next(storage, e); storage.clear()) {
+		try {
+		  lisp::autoload(env, lisp::convert(e), vm ? lisp::vm::eval : eval);
+		} catch( lisp::error& err ) {
+		  std::cerr << "prelude error: " << err.what() << std::endl << err.details;
+		}
+	  }
+	} catch( std::runtime_error& e ) {
+	  std::cerr << "prelude error: " << e.what() << std::endl;
+	}
+  }
+
+
+  static lisp::value eval(lisp::environment& env, const lisp::value& expr) {
+	return lisp::eval(env, lisp::expand(env, expr));
+  }
+
+  
+  void run(form_reader& forms, bool print) const {
+	sexpr::arena storage;
+	
+	for(sexpr::node e; forms.next(storage, e); storage.clear()) {
+	  try {
+		const lisp::value expr = lisp::convert(e);
+		const lisp::value res = vm ? lisp::vm::eval(env, expr) : eval(env, expr);
+
+		if( print && !(res.is<lisp::list>() && !res.as<lisp::list>()) ) {
+		  std::cout << res << std::endl;
+		}
+	  } catch( lisp::error& e ) {
+		std::cerr << "error: " << e.what() << std::endl << e.details;
+	  }
+	}
+  }
+  
+  void operator()(form_reader& forms) const {
+	run(forms, true);
+  }
+  
+};
+
+
+
 int main(int argc, const char* argv[] ) {
 
   std::cout << std::boolalpha;
   std::cerr << std::boolalpha;  
 
-  sexpr_parser parser{ hm_handler{} };
-  // parser.handler = hm_handler{};
+  bool lisp = false, vm = false;
+  unsigned jobs = 0;
+  std::string image, save_image;
+  
+  for(; argc > 1 && argv[1][0] == '-'; --argc, ++argv) {
+	const std::string opt = argv[1];
+
+	// -j N: infer independent definitions on N threads
+	if( opt == "-j" && argc > 2 ) {
+	  jobs = std::stoi(argv[2]);
+	  --argc;
+	  ++argv;
+	} else if( opt == "--lisp" ) {
+	  lisp = true;
+	} else if( opt == "--vm" ) {
+	  lisp = vm = true;
+	} else if( opt == "--image" && argc > 2 ) {
+	  // --image FILE: load the lisp prelude from a heap image
+	  image = argv[2];
+	  lisp = true;
+	  --argc;
+	  ++argv;
+	} else if( opt == "--save-image" && argc > 2 ) {
+	  // --save-image FILE: save the lisp prelude as a heap image and exit
+	  save_image = argv[2];
+	  lisp = true;
+	  --argc;
+	  ++argv;
+	} else {
+	  std::cerr << "usage: hm [-j N] [--lisp] [--vm] [--image FILE] [--save-image FILE] [file]"
+				<< std::endl;
+	  return 1;
+	}
+  }
+  
+  sexpr_parser parser;
 
-  if( argc > 1 ) {
-	std::ifstream file(  argv[1] );
-	if( !file ) throw std::runtime_error("file not found");
-	
-	parser( file );
+  if( lisp ) {
+	try {
+	  const lisp_handler handler(vm, image);
+	  
+	  if( !save_image.empty() ) {
+		lisp::image::save(handler.env, save_image);
+		return 0;
+	  }
+	  
+	  parser.handler = handler;
+	} catch( lisp::error& e ) {
+	  std::cerr << "image error: " << e.what() << std::endl;
+	  return 1;
+	}
+  } else {
+	hm_handler handler;
+	if( jobs ) handler.pool = std::make_shared<thread_pool>( jobs );
 	
+	parser.handler = handler;
+  }
+  
+  if( argc > 1 ) {
+	parser.file( argv[1] );
   } else {
 
 	repl::loop( parser );
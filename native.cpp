@@ -0,0 +1,389 @@
+#include "lisp.hpp"
+#include "builtin.hpp"
+#include "jit.hpp"
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Transforms/Scalar.h>
+
+#include <sstream>
+
+namespace lisp {
+
+  namespace native {
+
+	// hot lambdas are compiled when their body only does integer
+	// arithmetic and comparisons on its arguments, conditionals and calls
+	// to itself. compiled code takes and returns integers: calls are
+	// guarded on argument types and on the global bindings the code was
+	// compiled against, and fall back to the interpreter otherwise.
+	struct code_type {
+	  // code is shared by closures with the same body, which is kept alive
+	  value body;
+	  symbol name;
+	  std::size_t argc = 0;
+
+	  // builtins inlined in the code
+	  vec< std::pair<symbol, builtin> > builtins;
+
+	  // null when the body cannot be compiled
+	  integer (*entry)(const integer* args) = nullptr;
+
+	  // global environment and epoch the guard last passed in
+	  const environment_type* root = nullptr;
+	  std::size_t epoch = 0;
+	};
+
+
+	// the body uses something we don't compile
+	struct unsupported { };
+
+	// some global binding changed since compilation
+	struct guard_failed { };
+
+	// arguments are passed in a buffer on the stack
+	static constexpr std::size_t max_argc = 16;
+
+
+	static ::jit& instance() {
+	  static ::jit* res = [] {
+		::jit::init();
+		return new ::jit;
+	  }();
+
+	  return *res;
+	}
+
+
+	class compiler {
+	  llvm::LLVMContext& context;
+	  llvm::IRBuilder<> builder;
+
+	  const lambda_type& self;
+	  code_type& code;
+
+	  llvm::Function* func = nullptr;
+	  llvm::Type* int_type;
+	  vec<llvm::Value*> args;
+
+	  // only false is false
+	  static bool truthy(const value& e) {
+		if( e.is<boolean>() ) return e.as<boolean>();
+		if( e.is<integer>() || e.is<real>() || e.is<string>() ) return true;
+
+		static const symbol quote = "quote";
+
+		if( e.is<list>() && length(e.as<list>()) == 2 && e.as<list>()->head.is<symbol>() &&
+			e.as<list>()->head.as<symbol>() == quote ) {
+		  const value& x = e.as<list>()->tail->head;
+		  return !x.is<boolean>() || x.as<boolean>();
+		}
+
+		return false;
+	  }
+
+
+	  llvm::Value* integer_expr(const value& e) {
+		bool test;
+		llvm::Value* res = expr(e, test);
+		if( test ) throw unsupported();
+		return res;
+	  }
+
+	  llvm::Value* boolean_expr(const value& e) {
+		bool test;
+		llvm::Value* res = expr(e, test);
+		if( !test ) throw unsupported();
+		return res;
+	  }
+
+
+	  llvm::Value* cond(const list& clauses) {
+		llvm::BasicBlock* done = llvm::BasicBlock::Create(context, "done", func);
+		vec< std::pair<llvm::Value*, llvm::BasicBlock*> > results;
+
+		for(const value& c : clauses) {
+		  if( !c.is<list>() || length(c.as<list>()) != 2 ) throw unsupported();
+		  const list& clause = c.as<list>();
+
+		  // last clause
+		  if( truthy(clause->head) ) {
+			llvm::Value* res = integer_expr(clause->tail->head);
+			results.emplace_back(res, builder.GetInsertBlock());
+			builder.CreateBr(done);
+
+			builder.SetInsertPoint(done);
+			llvm::PHINode* phi = builder.CreatePHI(int_type, results.size());
+
+			for(const auto& it : results) {
+			  phi->addIncoming(it.first, it.second);
+			}
+
+			return phi;
+		  }
+
+		  llvm::Value* test = boolean_expr(clause->head);
+
+		  llvm::BasicBlock* then = llvm::BasicBlock::Create(context, "then", func);
+		  llvm::BasicBlock* next = llvm::BasicBlock::Create(context, "else", func);
+		  builder.CreateCondBr(test, then, next);
+
+		  builder.SetInsertPoint(then);
+		  llvm::Value* res = integer_expr(clause->tail->head);
+		  results.emplace_back(res, builder.GetInsertBlock());
+		  builder.CreateBr(done);
+
+		  builder.SetInsertPoint(next);
+		}
+
+		// no result when no clause matches
+		throw unsupported();
+	  }
+
+
+	  llvm::Value* call(symbol name, const list& operands, bool& test) {
+		vec<llvm::Value*> values;
+		for(const value& x : operands) {
+		  values.push_back( integer_expr(x) );
+		}
+
+		test = false;
+
+		if( name == self.name ) {
+		  if( values.size() != args.size() ) throw unsupported();
+		  return builder.CreateCall(func, values);
+		}
+
+		if( values.size() != 2 ) throw unsupported();
+
+		const builtin b = primitive(name);
+		if( !b ) throw unsupported();
+
+		llvm::Value* lhs = values[0];
+		llvm::Value* rhs = values[1];
+		llvm::Value* res;
+
+		// integers wrap around, as in builtins
+		if( name == "number-add" ) {
+		  res = builder.CreateAdd(lhs, rhs);
+		} else if( name == "number-sub" ) {
+		  res = builder.CreateSub(lhs, rhs);
+		} else if( name == "number-mul" ) {
+		  res = builder.CreateMul(lhs, rhs);
+		} else if( name == "number=?" ) {
+		  res = builder.CreateICmpEQ(lhs, rhs);
+		  test = true;
+		} else if( name == "number<?" ) {
+		  res = builder.CreateICmpSLT(lhs, rhs);
+		  test = true;
+		} else {
+		  throw unsupported();
+		}
+
+		code.builtins.emplace_back(name, b);
+		return res;
+	  }
+
+
+	  // test is set for boolean results
+	  llvm::Value* expr(const value& e, bool& test) {
+		test = false;
+
+		if( e.is<integer>() ) {
+		  return llvm::ConstantInt::get(int_type, e.as<integer>(), true);
+		}
+
+		if( e.is<boolean>() ) {
+		  test = true;
+		  return builder.getInt1( e.as<boolean>() );
+		}
+
+		if( e.is<address>() ) {
+		  const address& a = e.as<address>();
+		  if( a->depth != 0 || a->index >= args.size() ) throw unsupported();
+
+		  return args[a->index];
+		}
+
+		if( !e.is<list>() || !e.as<list>() ) throw unsupported();
+		const list& x = e.as<list>();
+
+		static const symbol cond_ = "cond";
+
+		if( x->head.is<symbol>() && x->head.as<symbol>() == cond_ ) {
+		  return cond(x->tail);
+		}
+
+		if( x->head.is<address>() && x->head.as<address>()->index == address_type::global ) {
+		  return call(x->head.as<address>()->name, x->tail, test);
+		}
+
+		throw unsupported();
+	  }
+
+	public:
+
+	  compiler(const lambda_type& self, code_type& code)
+		: context(llvm::getGlobalContext()),
+		  builder(context),
+		  self(self),
+		  code(code),
+		  int_type(llvm::IntegerType::get(context, 8 * sizeof(integer))) {
+
+	  }
+
+
+	  std::unique_ptr<llvm::Module> operator()(const std::string& name) {
+		if( self.vararg || !self.name.name() ) throw unsupported();
+		if( self.args.size() > max_argc ) throw unsupported();
+
+		std::unique_ptr<llvm::Module> module( new llvm::Module(name, context) );
+		module->setDataLayout(instance().layout);
+
+		// integer (integer, ...)
+		{
+		  vec<llvm::Type*> params(self.args.size(), int_type);
+		  llvm::FunctionType* type = llvm::FunctionType::get(int_type, params, false);
+		  func = llvm::Function::Create(type, llvm::Function::InternalLinkage,
+										name + "_code", module.get());
+		}
+
+		for(auto& a : func->args() ) {
+		  args.push_back(&a);
+		}
+
+		builder.SetInsertPoint( llvm::BasicBlock::Create(context, "entry", func) );
+		builder.CreateRet( integer_expr(self.body) );
+
+		// integer (const integer* args)
+		{
+		  llvm::FunctionType* type =
+			llvm::FunctionType::get(int_type, {llvm::PointerType::get(int_type, 0)}, false);
+
+		  llvm::Function* entry = llvm::Function::Create(type, llvm::Function::ExternalLinkage,
+														 name, module.get());
+		  builder.SetInsertPoint( llvm::BasicBlock::Create(context, "entry", entry) );
+
+		  llvm::Value* ptr = &*entry->arg_begin();
+
+		  vec<llvm::Value*> values;
+		  for(std::size_t i = 0, n = args.size(); i < n; ++i) {
+			values.push_back( builder.CreateLoad( builder.CreateConstInBoundsGEP1_32(int_type, ptr, i) ) );
+		  }
+
+		  builder.CreateRet( builder.CreateCall(func, values) );
+		}
+
+		if( llvm::verifyModule(*module) ) throw unsupported();
+
+		// self calls in tail position become loops
+		llvm::legacy::FunctionPassManager fpm(module.get());
+		fpm.add(llvm::createInstructionCombiningPass());
+		fpm.add(llvm::createReassociatePass());
+		fpm.add(llvm::createGVNPass());
+		fpm.add(llvm::createCFGSimplificationPass());
+		fpm.add(llvm::createTailCallEliminationPass());
+		fpm.doInitialization();
+
+		for(llvm::Function& f : *module) {
+		  fpm.run(f);
+		}
+
+		return module;
+	  }
+
+	};
+
+
+	// compiled code by lambda body
+	static std::unordered_map<const cons*, ref<code_type>> cache;
+
+	static ref<code_type> compile(const lambda_type& self) {
+	  const cons* key = self.body.is<list>() ? self.body.as<list>().get() : nullptr;
+
+	  if( key ) {
+		auto it = cache.find(key);
+		if( it != cache.end() ) return it->second;
+	  }
+
+	  ref<code_type> res = shared<code_type>();
+	  res->body = self.body;
+	  res->name = self.name;
+	  res->argc = self.args.size();
+
+	  static std::size_t id = 0;
+	  std::stringstream ss;
+	  ss << "__lisp_native_" << id++;
+	  const std::string name = ss.str();
+
+	  try {
+		instance().add( compiler(self, *res)(name) );
+		res->entry = reinterpret_cast<integer (*)(const integer*)>( instance().find(name).getAddress() );
+	  } catch( unsupported& ) {
+		res->builtins.clear();
+	  }
+
+	  if( key ) cache.emplace(key, res);
+	  return res;
+	}
+
+
+	// global bindings still match what the code was compiled against. calls
+	// were resolved past every enclosing frame, so only the root binds them
+	static bool guard(const lambda_type& self, code_type& code) {
+	  environment_type* root = self.env->root();
+	  if( code.root == root && code.epoch == environment_type::epoch ) return true;
+
+	  const auto fail = [] { throw guard_failed(); };
+
+	  try {
+		const value& f = root->find(code.name, fail);
+		if( !f.is<lambda>() || f.as<lambda>()->body != code.body ) return false;
+
+		for(const auto& it : code.builtins) {
+		  const value& b = root->find(it.first, fail);
+		  if( !b.is<builtin>() || b.as<builtin>() != it.second ) return false;
+		}
+	  } catch( guard_failed& ) {
+		return false;
+	  } catch( environment_type::key_error& ) {
+		return false;
+	  }
+
+	  // read after the lookups, which may have autoloaded definitions
+	  code.root = root;
+	  code.epoch = environment_type::epoch;
+	  
+	  return true;
+	}
+
+
+	void compile(const lambda& self) {
+	  ref<code_type> res = compile(*self);
+	  if( res->entry ) self->code = std::move(res);
+	}
+	
+
+	bool call(const lambda& self, value* first, value* last, value& res) {
+	  code_type& code = *self->code;
+	  if( std::size_t(last - first) != code.argc ) return false;
+
+	  // argument types
+	  integer args[max_argc];
+	  for(std::size_t i = 0; i < code.argc; ++i) {
+		if( !first[i].is<integer>() ) return false;
+		args[i] = first[i].as<integer>();
+	  }
+
+	  if( !guard(*self, code) ) return false;
+
+	  res = code.entry(args);
+	  return true;
+	}
+
+  }
+
+}
@@ -1,6 +1,16 @@
 #include "parse.hpp"
 
 #include <sstream>
+#include <limits>
+#include <iterator>
+#include <deque>
+#include <cerrno>
+#include <cstdlib>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <boost/spirit/include/qi.hpp>
 #include <boost/phoenix/operator.hpp>
@@ -9,10 +19,10 @@
 
 
 template<class Iterator>
-static std::string error_report(Iterator first, Iterator last, Iterator err) {
+static std::string error_report(Iterator first, Iterator last, Iterator err,
+								unsigned line = 1) {
 
   Iterator line_start = first;
-  unsigned line = 1;
 
   Iterator curr;
   for(curr = first; curr != err; ++curr) {
@@ -72,7 +82,7 @@ static sexpr::list quasiquote_expr(sexpr::expr& expr) {
 
 
 template<class Iterator>
-static sexpr::list parse(Iterator first, Iterator last) {
+static sexpr::list parse_spirit(Iterator first, Iterator last) {
   using namespace boost::spirit;
 
   using boost::phoenix::function;
@@ -139,8 +149,453 @@ static sexpr::list parse(Iterator first, Iterator last) {
 }
 
 
-sexpr::list parse(std::istream& in) {
+sexpr::list parse_spirit(std::istream& in) {
   in >> std::noskipws;
   boost::spirit::istream_iterator first(in), last;
-  return parse(first, last);
+  return parse_spirit(first, last);
+}
+
+
+
+// builds owning expressions on a stack, lists collect the expressions
+// pushed since their mark
+struct expr_builder {
+  vec<sexpr::expr> stack;
+
+  void push(sexpr::boolean value) { stack.emplace_back(value); }
+  void push(sexpr::integer value) { stack.emplace_back(value); }
+  void push(sexpr::real value) { stack.emplace_back(value); }
+  void push(symbol value) { stack.emplace_back(value); }
+
+  void push(const char* first, const char* last) {
+	stack.emplace_back( sexpr::string(first, last) );
+  }
+
+  std::size_t open() const { return stack.size(); }
+
+  void close(std::size_t mark) {
+	sexpr::list res(std::make_move_iterator(stack.begin() + mark),
+					std::make_move_iterator(stack.end()));
+	stack.resize(mark);
+	stack.emplace_back( std::move(res) );
+  }
+
+  sexpr::expr pop() {
+	sexpr::expr res = std::move(stack.back());
+	stack.pop_back();
+	return res;
+  }
+};
+
+
+// hand-written recursive descent parser over a contiguous buffer,
+// equivalent to the spirit grammar above. symbols are interned straight
+// from the buffer. parsed expressions are pushed to a builder: either an
+// expr_builder or a sexpr::arena.
+class reader {
+  const char* first;
+  const char* last;
+  const char* it;
+
+  // line number of first, for diagnostics
+  unsigned line;
+
+  static bool space(char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+  }
+
+  // symbol constituents
+  static bool constituent(char c) {
+	const unsigned char u = c;
+	return u > 0x20 && u != 0x7f && c != '(' && c != ')' && c != ';' && c != '"';
+  }
+
+  static bool digit(char c) { return c >= '0' && c <= '9'; }
+  
+  // whitespace and comments
+  void skip() {
+	while( it != last ) {
+	  if( space(*it) ) {
+		++it;
+	  } else if( *it == ';' ) {
+		while( it != last && *it != '\n' ) ++it;
+	  } else {
+		break;
+	  }
+	}
+  }
+  
+  [[noreturn]] void error(const char* what, const char* where) const {
+	throw parse_error(what + error_report(first, last, where, line));
+  }
+
+  
+  template<class Builder>
+  void quote(Builder& out, const char* name) {
+	++it;
+	skip();
+	if( it == last || *it == ')' ) error("quoted expression expected ", it);
+
+	const std::size_t mark = out.open();
+	out.push( symbol(name) );
+	expr(out);
+	out.close(mark);
+  }
+  
+  
+  template<class Builder>
+  void expr(Builder& out) {
+	switch( *it ) {
+	case '\'': return quote(out, "quote");
+	case '`': return quote(out, "quasiquote");
+	case ',': return quote(out, "unquote");
+	case '(': return list(out);
+	case '"': return string(out);
+	default: return atom(out);
+	}
+  }
+
+  
+  template<class Builder>
+  void list(Builder& out) {
+	const char* start = it++;
+	
+	const std::size_t mark = out.open();
+	
+	while( true ) {
+	  skip();
+	  
+	  if( it == last ) error("unmatched parenthesis ", start);
+	  if( *it == ')' ) break;
+	  
+	  expr(out);
+	}
+
+	++it;
+	out.close(mark);
+  }
+
+  
+  template<class Builder>
+  void string(Builder& out) {
+	const char* start = ++it;
+	while( it != last && *it != '"') ++it;
+
+	if( it == last ) error("unterminated string ", start - 1);
+	
+	out.push(start, it++);
+  }
+
+
+  // [+-]? digits
+  static bool integer(const char* first, const char* last) {
+	if( first != last && (*first == '+' || *first == '-') ) ++first;
+	if( first == last ) return false;
+	
+	for(; first != last; ++first) {
+	  if( !digit(*first) ) return false;
+	}
+	return true;
+  }
+
+  // [+-]? (digits . digits? | . digits | digits) ([eE] [+-]? digits)?, with
+  // a dot or an exponent
+  static bool real(const char* first, const char* last) {
+	if( first != last && (*first == '+' || *first == '-') ) ++first;
+
+	unsigned mantissa = 0;
+	bool dot = false, exponent = false;
+
+	for(; first != last && digit(*first); ++first) ++mantissa;
+	
+	if( first != last && *first == '.' ) {
+	  dot = true;
+	  for(++first; first != last && digit(*first); ++first) ++mantissa;
+	}
+
+	if( !mantissa ) return false;
+
+	if( first != last && (*first == 'e' || *first == 'E') ) {
+	  exponent = true;
+	  ++first;
+	  if( first != last && (*first == '+' || *first == '-') ) ++first;
+	  if( first == last ) return false;
+	  
+	  for(; first != last; ++first) {
+		if( !digit(*first) ) return false;
+	  }
+	}
+	
+	return first == last && (dot || exponent);
+  }
+
+  
+  template<class Builder>
+  void atom(Builder& out) {
+	const char* start = it;
+	while( it != last && constituent(*it) ) ++it;
+
+	if( it == start ) error("unexpected character ", start);
+	
+	const std::size_t size = it - start;
+	
+	if( integer(start, it) || real(start, it) ) {
+	  // input is not null-terminated: copy to a buffer, or a string for
+	  // long tokens
+	  char buffer[64];
+	  std::string copy;
+	  
+	  const char* token = buffer;
+	  if( size < sizeof(buffer) ) {
+		std::copy(start, it, buffer);
+		buffer[size] = 0;
+	  } else {
+		copy.assign(start, it);
+		token = copy.c_str();
+	  }
+
+	  char* end;
+		
+	  if( integer(start, it) ) {
+		errno = 0;
+		const long value = std::strtol(token, &end, 10);
+		  
+		// too large: symbol
+		if( !errno && value >= std::numeric_limits<sexpr::integer>::min()
+			&& value <= std::numeric_limits<sexpr::integer>::max() ) {
+		  return out.push( sexpr::integer(value) );
+		}
+	  } else {
+		return out.push( sexpr::real( std::strtod(token, &end) ) );
+	  }
+	}
+
+	if( size == 4 && std::equal(start, it, "true") ) return out.push(true);
+	if( size == 5 && std::equal(start, it, "false") ) return out.push(false);
+	
+	out.push( symbol(start, size) );
+  }
+
+public:
+
+  reader(const char* first, const char* last, unsigned line = 1)
+	: first(first), last(last), it(first), line(line) { }
+
+  // push next toplevel form, false at end of input
+  template<class Builder>
+  bool next(Builder& out) {
+	skip();
+	if( it == last ) return false;
+	
+	if( *it == ')' ) error("unmatched parenthesis ", it);
+	expr(out);
+	
+	return true;
+  }
+
+  // list of all toplevel forms
+  template<class Builder>
+  auto program(Builder& out) -> decltype(out.pop()) {
+	const std::size_t mark = out.open();
+	while( next(out) ) { }
+	out.close(mark);
+	
+	return out.pop();
+  }
+  
+};
+
+
+// parses forms one at a time
+struct form_reader::source {
+  expr_builder builder;
+  reader parser{nullptr, nullptr};
+  
+  virtual ~source() { }
+
+  // more input for the parser, false at end of input
+  virtual bool fill() { return false; }
+
+  // nothing points into input already parsed
+  virtual void release() { }
+  
+  template<class Builder>
+  bool next(Builder& out) {
+	while( !parser.next(out) ) {
+	  if( !fill() ) return false;
+	}
+	
+	return true;
+  }
+};
+
+
+struct form_reader::buffer : source {
+  buffer(const char* first, const char* last) {
+	parser = reader(first, last);
+  }
+};
+
+
+struct form_reader::mapping : source {
+  int fd = -1;
+  void* data = MAP_FAILED;
+  std::size_t size = 0;
+
+  mapping(const std::string& path) {
+	fd = open(path.c_str(), O_RDONLY);
+	if( fd == -1 ) throw std::runtime_error("file not found: " + path);
+
+	struct stat info;
+	if( fstat(fd, &info) == -1 ) {
+	  close(fd);
+	  throw std::runtime_error("cannot stat: " + path);
+	}
+
+	size = info.st_size;
+	if( !size ) return;
+	
+	data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if( data == MAP_FAILED ) {
+	  close(fd);
+	  throw std::runtime_error("cannot map: " + path);
+	}
+	
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	const char* first = static_cast<const char*>(data);
+	parser = reader(first, first + size);
+  }
+  
+  ~mapping() {
+	if( data != MAP_FAILED ) munmap(data, size);
+	if( fd != -1 ) close(fd);
+  }
+};
+
+
+// reads whole lines until the toplevel forms read so far are complete, then
+// parses them from the line buffer. chunks are kept until released, as
+// arena nodes may point into any of them
+struct form_reader::stream : source {
+  std::istream& in;
+  
+  std::deque<std::string> chunks;
+
+  // line number of the next chunk
+  unsigned line = 1;
+  
+  stream(std::istream& in) : in(in) { }
+
+  // the parser may still be reading the last chunk
+  void release() {
+	while( chunks.size() > 1 ) chunks.pop_front();
+  }
+  
+  bool fill() {
+	chunks.emplace_back();
+	std::string& chunk = chunks.back();
+
+	const unsigned start = line;
+	
+	int depth = 0;
+	bool string = false, quote = false, started = false;
+
+	std::string buf;
+	while( std::getline(in, buf) ) {
+	  ++line;
+	  chunk += buf;
+	  chunk += '\n';
+
+	  for(char c : buf) {
+		if( string ) {
+		  string = c != '"';
+		  continue;
+		}
+		
+		if( c == ';' ) break;
+
+		switch( c ) {
+		case ' ': case '\t': case '\r': case '\v': case '\f': continue;
+		case '"': string = true; break;
+		case '(': ++depth; break;
+		case ')': --depth; break;
+		}
+		
+		started = true;
+		quote = (c == '\'' || c == '`' || c == ',');
+	  }
+	  
+	  if( started && !string && !quote && depth <= 0 ) break;
+	}
+
+	// incomplete forms at end of input are reported by the parser
+	parser = reader(chunk.data(), chunk.data() + chunk.size(), start);
+	return started;
+  }
+};
+
+
+form_reader::form_reader(source* impl) : impl(impl) { }
+
+form_reader::form_reader(const char* first, const char* last)
+  : impl(new buffer(first, last)) { }
+
+form_reader::form_reader(std::istream& in)
+  : impl(new stream(in)) { }
+
+form_reader form_reader::file(const std::string& path) {
+  return form_reader(new mapping(path));
+}
+
+form_reader::form_reader(form_reader&&) = default;
+form_reader::~form_reader() = default;
+
+bool form_reader::next(sexpr::expr& out) {
+  // expressions own their strings
+  impl->release();
+  if( !impl->next(impl->builder) ) return false;
+
+  out = impl->builder.pop();
+  return true;
+}
+
+bool form_reader::next(sexpr::arena& storage, sexpr::node& out) {
+  if( !storage.size() ) impl->release();
+  if( !impl->next(storage) ) return false;
+
+  out = storage.pop();
+  return true;
+}
+
+
+sexpr::list parse(const char* first, const char* last) {
+  expr_builder builder;
+  sexpr::expr res = reader(first, last).program(builder);
+  return std::move(res.as<sexpr::list>());
+}
+
+
+sexpr::range parse(const char* first, const char* last, sexpr::arena& storage) {
+  return reader(first, last).program(storage).as<sexpr::list>();
+}
+
+
+sexpr::list parse(std::istream& in) {
+  const std::string buffer{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+  return parse(buffer.data(), buffer.data() + buffer.size());
+}
+
+
+sexpr::list parse_file(const std::string& path) {
+  form_reader forms = form_reader::file(path);
+
+  sexpr::list res;
+  
+  sexpr::expr e;
+  while( forms.next(e) ) {
+	res.push_back( std::move(e) );
+  }
+  
+  return res;
 }
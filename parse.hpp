@@ -3,12 +3,59 @@
 
 #include "sexpr.hpp"
 #include <istream>
+#include <memory>
 
 struct parse_error : std::runtime_error {
   using std::runtime_error::runtime_error;
 };
 
+// parse a whole program
 sexpr::list parse(std::istream& in);
+sexpr::list parse(const char* first, const char* last);
+
+// parse a whole program into an arena: strings point into the buffer, which
+// must outlive the arena contents. toplevel forms are the returned range
+sexpr::range parse(const char* first, const char* last, sexpr::arena& storage);
+
+// parse a file through a read-only memory mapping
+sexpr::list parse_file(const std::string& path);
+
+// pull-style parser yielding one toplevel form at a time, so that forms
+// can be processed as soon as they are read
+class form_reader {
+  struct source;
+  struct buffer;
+  struct mapping;
+  struct stream;
+  
+  std::unique_ptr<source> impl;
+  form_reader(source* impl);
+public:
+
+  form_reader(const char* first, const char* last);
+
+  // input is read line by line until toplevel forms are complete
+  form_reader(std::istream& in);
+
+  // read-only memory mapping
+  static form_reader file(const std::string& path);
+  
+  form_reader(form_reader&&);
+  ~form_reader();
+  
+  // false at end of input
+  bool next(sexpr::expr& out);
+
+  // parse next form into storage, without copies: strings point into the
+  // input. stream input is only freed when storage is found empty, so
+  // callers should clear storage once they are done with its forms to
+  // keep memory bounded
+  bool next(sexpr::arena& storage, sexpr::node& out);
+};
+
+
+// reference boost::spirit parser
+sexpr::list parse_spirit(std::istream& in);
 
 
 #endif
@@ -0,0 +1,267 @@
+#include "lisp.hpp"
+
+#include <chrono>
+#include <ostream>
+#include <algorithm>
+
+#include <signal.h>
+#include <sys/time.h>
+
+namespace lisp {
+
+  namespace profile {
+	bool enabled = false;
+  }
+
+
+  // the evaluator reports lambda activations on a shadow stack. each
+  // activation is a node in a calling context tree, so that time and
+  // samples are attributed to whole call stacks. sampling uses a
+  // profiling timer: the signal handler only raises a flag, and the
+  // sample is taken at the next call boundary.
+  class profiler {
+	using clock = std::chrono::steady_clock;
+
+	struct node {
+	  std::size_t entry;
+	  std::unordered_map<const void*, node*> children;
+
+	  double exclusive = 0;
+	  std::size_t samples = 0;
+
+	  node(std::size_t entry) : entry(entry) { }
+	};
+
+	struct activation {
+	  node* self;
+	  clock::time_point start;
+	  double children;
+
+	  activation(node* self)
+		: self(self), start(clock::now()), children(0) { }
+	};
+
+	struct stats : profile::entry {
+	  std::size_t active = 0;
+	};
+
+	vec<stats> entries;
+	std::unordered_map<const void*, std::size_t> index;
+
+	vec<std::unique_ptr<node>> nodes;
+	node* root = nullptr;
+
+	vec<activation> stack;
+	bool sampling = false;
+	struct sigaction previous;
+
+	static volatile sig_atomic_t pending;
+
+	static void handler(int) { pending = 1; }
+
+	// lambda templates and their closures share their body
+	static const void* key(const lambda_type* self) {
+	  return self->body.is<list>() ? static_cast<const void*>(self->body.as<list>().get()) : self;
+	}
+
+
+	node* make_node(std::size_t entry) {
+	  nodes.emplace_back( new node(entry) );
+	  return nodes.back().get();
+	}
+
+
+	node* child(node* parent, const lambda_type* self) {
+	  const void* k = key(self);
+
+	  node*& res = parent->children[k];
+	  if( res ) return res;
+
+	  auto it = index.find(k);
+	  if( it == index.end() ) {
+		it = index.emplace(k, entries.size()).first;
+		entries.emplace_back();
+		entries.back().name = self->name.name() ? self->name : symbol("lambda");
+	  }
+
+	  return res = make_node(it->second);
+	}
+
+
+	void sample() {
+	  pending = 0;
+
+	  node* top = stack.empty() ? root : stack.back().self;
+	  ++top->samples;
+	  if( top != root ) ++entries[top->entry].samples;
+	}
+
+
+	void push(const lambda_type* self) {
+	  node* parent = stack.empty() ? root : stack.back().self;
+	  node* n = child(parent, self);
+
+	  stats& s = entries[n->entry];
+	  ++s.calls;
+	  ++s.active;
+
+	  stack.emplace_back(n);
+	}
+
+
+	void pop() {
+	  const activation a = stack.back();
+	  stack.pop_back();
+
+	  const std::chrono::duration<double, std::milli> elapsed = clock::now() - a.start;
+	  const double exclusive = elapsed.count() - a.children;
+
+	  a.self->exclusive += exclusive;
+
+	  stats& s = entries[a.self->entry];
+	  s.exclusive += exclusive;
+	  if( --s.active == 0 ) s.inclusive += elapsed.count();
+
+	  if( !stack.empty() ) stack.back().children += elapsed.count();
+	}
+
+
+	void collapsed(std::ostream& out, const node* n, std::string& path) const {
+	  const std::size_t size = path.size();
+
+	  if( n != root ) {
+		if( !path.empty() ) path += ';';
+		path += entries[n->entry].name.name();
+
+		const std::size_t count = sampling ? n->samples : std::size_t(n->exclusive * 1000);
+		if( count ) out << path << ' ' << count << '\n';
+	  }
+
+	  for(const auto& it : n->children) {
+		collapsed(out, it.second, path);
+	  }
+
+	  path.resize(size);
+	}
+
+  public:
+	std::size_t session = 0;
+
+	void start(double interval) {
+	  if( profile::enabled ) stop();
+
+	  entries.clear();
+	  index.clear();
+	  nodes.clear();
+	  stack.clear();
+	  root = make_node(0);
+
+	  ++session;
+	  profile::enabled = true;
+	  pending = 0;
+
+	  sampling = interval > 0;
+	  if( !sampling ) return;
+
+	  struct sigaction action;
+	  action.sa_handler = handler;
+	  action.sa_flags = SA_RESTART;
+	  sigemptyset(&action.sa_mask);
+	  sigaction(SIGPROF, &action, &previous);
+
+	  const long usec = std::max(1l, long(interval * 1000));
+	  itimerval timer;
+	  timer.it_interval.tv_sec = usec / 1000000;
+	  timer.it_interval.tv_usec = usec % 1000000;
+	  timer.it_value = timer.it_interval;
+	  setitimer(ITIMER_PROF, &timer, nullptr);
+	}
+
+
+	void stop() {
+	  if( !profile::enabled ) return;
+	  profile::enabled = false;
+
+	  // account for activations still running
+	  while( !stack.empty() ) pop();
+
+	  if( sampling ) {
+		itimerval timer = {};
+		setitimer(ITIMER_PROF, &timer, nullptr);
+		sigaction(SIGPROF, &previous, nullptr);
+	  }
+	}
+
+
+	std::size_t enter(const lambda_type* self) {
+	  if( pending ) sample();
+	  push(self);
+	  return session;
+	}
+
+	void replace(std::size_t id, const lambda_type* self) {
+	  if( id != session || stack.empty() ) return;
+	  if( pending ) sample();
+
+	  pop();
+	  push(self);
+	}
+
+	void leave(std::size_t id) {
+	  if( id != session || stack.empty() ) return;
+	  if( pending ) sample();
+
+	  pop();
+	}
+
+
+	vec<profile::entry> report() const {
+	  vec<profile::entry> res(entries.begin(), entries.end());
+
+	  std::sort(res.begin(), res.end(), [](const profile::entry& lhs, const profile::entry& rhs) {
+		  return lhs.exclusive > rhs.exclusive;
+		});
+
+	  return res;
+	}
+
+	void collapsed(std::ostream& out) const {
+	  if( !root ) return;
+
+	  std::string path;
+	  collapsed(out, root, path);
+	}
+
+  };
+
+  volatile sig_atomic_t profiler::pending = 0;
+
+
+  namespace profile {
+
+	static profiler& instance() {
+	  static profiler res;
+	  return res;
+	}
+
+	void start(double interval) { instance().start(interval); }
+	void stop() { instance().stop(); }
+
+	vec<entry> report() { return instance().report(); }
+	void collapsed(std::ostream& out) { instance().collapsed(out); }
+
+	std::size_t enter(const lambda_type* self) {
+	  return enabled ? instance().enter(self) : 0;
+	}
+
+	void replace(std::size_t session, const lambda_type* self) {
+	  instance().replace(session, self);
+	}
+
+	void leave(std::size_t session) {
+	  instance().leave(session);
+	}
+
+  }
+
+}
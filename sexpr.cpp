@@ -32,4 +32,198 @@ namespace sexpr {
 	return out;
   }
   
+
+
+  void arena::push(sexpr::boolean value) {
+	cell c;
+	c.type = boolean_kind;
+	c.boolean = value;
+	push(c);
+  }
+
+  void arena::push(sexpr::integer value) {
+	cell c;
+	c.type = integer_kind;
+	c.integer = value;
+	push(c);
+  }
+
+  void arena::push(sexpr::real value) {
+	cell c;
+	c.type = real_kind;
+	c.real = value;
+	push(c);
+  }
+
+  void arena::push(::symbol value) {
+	cell c;
+	c.type = symbol_kind;
+	c.symbol = value;
+	push(c);
+  }
+
+  void arena::push(const char* first, const char* last) {
+	cell c;
+	c.type = string_kind;
+	c.data = first;
+	c.size = last - first;
+	push(c);
+  }
+  
+
+  void arena::close(std::size_t mark) {
+	assert(mark <= stack.size());
+	
+	cell c;
+	c.type = list_kind;
+	c.first = cells.size();
+	c.size = stack.size() - mark;
+
+	// children are complete: move them to the arena
+	cells.insert(cells.end(), stack.begin() + mark, stack.end());
+	stack.resize(mark);
+
+	push(c);
+  }
+
+  
+  node arena::pop() {
+	assert(!stack.empty());
+	
+	cells.push_back(stack.back());
+	stack.pop_back();
+	
+	return node(this, cells.size() - 1);
+  }
+  
+  
+  struct flatten {
+
+	template<class T>
+	void operator()(const T& self, arena& out) const {
+	  out.push(self);
+	}
+
+	void operator()(const string& self, arena& out) const {
+	  out.push(self.data(), self.data() + self.size());
+	}
+	
+	void operator()(const list& self, arena& out) const {
+	  const std::size_t mark = out.open();
+	  
+	  for(const auto& xi : self) {
+		xi.apply(*this, out);
+	  }
+
+	  out.close(mark);
+	}
+	
+  };
+
+  
+  node arena::push(const expr& e) {
+	e.apply(flatten(), *this);
+	return pop();
+  }
+  
+
+  struct stream_node {
+
+	template<class T>
+	void operator()(const T& self, std::ostream& out) const {
+	  out << self;
+	}
+
+	void operator()(const range& self, std::ostream& out) const {
+	  out << '(';
+	
+	  bool first = true;
+	  for(const node& xi : self) {
+		if(!first) {
+		  out << ' ';
+		} else {
+		  first = false;
+		}
+		out << xi;
+	  }
+	  out << ')';
+	}
+	
+  };
+
+  
+  std::ostream& operator<<(std::ostream& out, const node& self) {
+	self.apply( stream_node(), out );
+	return out;
+  }
+  
+
+
+  struct copy_node {
+
+	template<class T>
+	expr operator()(const T& self) const {
+	  return self;
+	}
+
+	expr operator()(const text& self) const {
+	  return string(self);
+	}
+
+	// filled in place: expr only copies lists in
+	expr operator()(const range& self) const {
+	  expr res = list();
+	  
+	  list& children = res.as<list>();
+	  children.reserve(self.size());
+	  
+	  for(const node& xi : self) {
+		children.push_back( xi.apply<expr>(*this) );
+	  }
+	  
+	  return res;
+	}
+	
+  };
+
+  
+  expr copy(const node& self) {
+	return self.apply<expr>( copy_node() );
+  }
+
+  
+  struct equal_node {
+
+	template<class T>
+	bool operator()(const T& self, const expr& other) const {
+	  return other.is<T>() && other.as<T>() == self;
+	}
+
+	bool operator()(const text& self, const expr& other) const {
+	  if( !other.is<string>() ) return false;
+
+	  const string& s = other.as<string>();
+	  return self == text{s.data(), s.size()};
+	}
+
+	bool operator()(const range& self, const expr& other) const {
+	  if( !other.is<list>() ) return false;
+
+	  const list& x = other.as<list>();
+	  if( x.size() != self.size() ) return false;
+	  
+	  for(std::size_t i = 0, n = x.size(); i < n; ++i) {
+		if( self[i] != x[i] ) return false;
+	  }
+
+	  return true;
+	}
+	
+  };
+
+  
+  bool operator==(const node& lhs, const expr& rhs) {
+	return lhs.apply<bool>( equal_node(), rhs );
+  }
+  
 }
@@ -5,6 +5,8 @@
 #include "variant.hpp"
 
 #include <ostream>
+#include <cstdint>
+#include <algorithm>
 
 // parse tree
 namespace sexpr {
@@ -24,6 +26,201 @@ namespace sexpr {
 
   };
 
+
+  // compact parse tree: nodes are stored in a flat array owned by an
+  // arena, string payloads point into the source buffer and the children
+  // of a list are a contiguous range of nodes, stored as an offset. the
+  // whole tree is dropped at once by clearing the arena.
+  class arena;
+  class node;
+  class range;
+  
+  // string payload in the source buffer
+  struct text {
+	const char* data;
+	std::size_t size;
+
+	operator string() const { return string(data, size); }
+	
+	bool operator==(const text& other) const {
+	  return size == other.size && std::equal(data, data + size, other.data);
+	}
+
+	friend std::ostream& operator<<(std::ostream& out, const text& self) {
+	  return out.write(self.data, self.size);
+	}
+  };
+
+  
+  class arena {
+  public:
+	enum kind : unsigned char { boolean_kind, integer_kind, real_kind,
+								string_kind, symbol_kind, list_kind };
+	
+	struct cell {
+	  kind type;
+	  std::uint32_t size;		// string length or number of children
+	  
+	  union {
+		sexpr::boolean boolean;
+		sexpr::integer integer;
+		sexpr::real real;
+		const char* data;		// string payload
+		::symbol symbol;
+		std::uint32_t first;	// offset of first child
+	  };
+	  
+	  cell() : integer(0) { }
+	};
+
+  private:
+	vec<cell> cells;
+
+	// nodes of lists being built
+	vec<cell> stack;
+
+	void push(const cell& c) { stack.push_back(c); }
+	
+  public:
+
+	const cell& operator[](std::uint32_t i) const { return cells[i]; }
+	std::size_t size() const { return cells.size(); }
+	
+	// drop all nodes at once, keeping storage for reuse
+	void clear() {
+	  cells.clear();
+	  stack.clear();
+	}
+
+	// building: atoms and lists are pushed in order, a list collects the
+	// nodes pushed since its mark
+	void push(sexpr::boolean value);
+	void push(sexpr::integer value);
+	void push(sexpr::real value);
+	void push(::symbol value);
+	void push(const char* first, const char* last);
+
+	std::size_t open() const { return stack.size(); }
+	void close(std::size_t mark);
+	
+	// move the last complete node into the arena
+	node pop();
+
+	// append an owning expression. strings point into e, which must
+	// outlive the arena contents
+	node push(const expr& e);
+  };
+
+  
+  // node handle, with the same query interface as expr. as<string>() and
+  // as<list>() return text and range views
+  class node {
+	const arena* owner;
+	std::uint32_t index;
+
+	const arena::cell& self() const { return (*owner)[index]; }
+	
+	template<class T> struct view { using type = T; };
+	
+  public:
+	node() : owner(nullptr), index(0) { }
+	node(const arena* owner, std::uint32_t index) : owner(owner), index(index) { }
+
+	template<class T>
+	bool is() const;
+
+	template<class T>
+	typename view<T>::type as() const;
+
+	template<class Ret = void, class F, class ... Args>
+	Ret apply(const F& f, Args&& ... args) const;
+
+	bool operator==(const ::symbol& s) const {
+	  return self().type == arena::symbol_kind && self().symbol == s;
+	}
+	
+	friend std::ostream& operator<<(std::ostream& out, const node& self);
+  };
+
+  
+  class range {
+	const arena* owner;
+	std::uint32_t first, count;
+  public:
+	range(const arena* owner, std::uint32_t first, std::uint32_t count)
+	  : owner(owner), first(first), count(count) { }
+	
+	std::size_t size() const { return count; }
+	bool empty() const { return !count; }
+	
+	node operator[](std::size_t i) const { return node(owner, first + i); }
+
+	class iterator {
+	  const arena* owner;
+	  std::uint32_t index;
+	public:
+	  iterator(const arena* owner, std::uint32_t index) : owner(owner), index(index) { }
+	  
+	  node operator*() const { return node(owner, index); }
+	  iterator& operator++() { ++index; return *this; }
+	  iterator operator+(std::size_t n) const { return iterator(owner, index + n); }
+	  std::ptrdiff_t operator-(const iterator& other) const { return std::ptrdiff_t(index) - other.index; }
+	  
+	  bool operator==(const iterator& other) const { return index == other.index; }
+	  bool operator!=(const iterator& other) const { return index != other.index; }
+	};
+
+	iterator begin() const { return iterator(owner, first); }
+	iterator end() const { return iterator(owner, first + count); }
+  };
+  
+
+  // owning copy of a node
+  expr copy(const node& self);
+
+  // structural comparison with an owning expression
+  bool operator==(const node& lhs, const expr& rhs);
+  inline bool operator!=(const node& lhs, const expr& rhs) { return !(lhs == rhs); }
+  
+
+  template<> struct node::view<string> { using type = text; };
+  template<> struct node::view<list> { using type = range; };
+  
+  template<> inline bool node::is<boolean>() const { return self().type == arena::boolean_kind; }
+  template<> inline bool node::is<integer>() const { return self().type == arena::integer_kind; }
+  template<> inline bool node::is<real>() const { return self().type == arena::real_kind; }
+  template<> inline bool node::is<string>() const { return self().type == arena::string_kind; }
+  template<> inline bool node::is<symbol>() const { return self().type == arena::symbol_kind; }
+  template<> inline bool node::is<list>() const { return self().type == arena::list_kind; }
+
+  template<> inline boolean node::as<boolean>() const { assert(is<boolean>()); return self().boolean; }
+  template<> inline integer node::as<integer>() const { assert(is<integer>()); return self().integer; }
+  template<> inline real node::as<real>() const { assert(is<real>()); return self().real; }
+  template<> inline symbol node::as<symbol>() const { assert(is<symbol>()); return self().symbol; }
+  
+  template<> inline text node::as<string>() const {
+	assert(is<string>());
+	return {self().data, self().size};
+  }
+  
+  template<> inline range node::as<list>() const {
+	assert(is<list>());
+	return range(owner, self().first, self().size);
+  }
+
+  // dispatch on node type, like variant::apply
+  template<class Ret, class F, class ... Args>
+  inline Ret node::apply(const F& f, Args&& ... args) const {
+	switch( self().type ) {
+	case arena::boolean_kind: return f(as<boolean>(), std::forward<Args>(args)...);
+	case arena::integer_kind: return f(as<integer>(), std::forward<Args>(args)...);
+	case arena::real_kind: return f(as<real>(), std::forward<Args>(args)...);
+	case arena::string_kind: return f(as<string>(), std::forward<Args>(args)...);
+	case arena::symbol_kind: return f(as<symbol>(), std::forward<Args>(args)...);
+	default: return f(as<list>(), std::forward<Args>(args)...);
+	}
+  }
+  
 }
 
 
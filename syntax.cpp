@@ -12,35 +12,39 @@
 //   : std::runtime_error("syntax error: " + what) { };
 
 
-static struct {
-  symbol abs = "fn";
-  symbol let = "let";
-  symbol def = "def";
+static struct keywords {
+  symbol abs, let, def;
+  symbol type, seq, with;
+  symbol ret;	// TODO this one is not exactly a keyword, is it ?
+  symbol cond;
   
-  symbol type = "type";
-  symbol seq = "do";
-  symbol with = "with";
-  symbol ret = "return";	// TODO this one is not exactly a keyword, is it ?
-  symbol cond = "if";
-  
-  std::set<symbol> all = {abs, let, def, type, seq, with, ret, cond};
+  std::set<symbol> all;
+
+  keywords() {
+	symbol::intern({{&abs, "fn"}, {&let, "let"}, {&def, "def"},
+					{&type, "type"}, {&seq, "do"}, {&with, "with"},
+					{&ret, "return"}, {&cond, "if"}});
+	
+	all = {abs, let, def, type, seq, with, ret, cond};
+  }
   
 } keyword;
 
 
 // core expressions
-static ast::expr transform_expr(const sexpr::expr& e);
+static ast::expr transform_expr(const sexpr::node& e);
 
 
-static ast::let transform_let(const sexpr::list& e);
-static ast::abs transform_abs(const sexpr::list& e);
-static ast::app transform_app(const sexpr::list& e);
-static ast::var transform_var(const sexpr::expr& e);
+static ast::let transform_let(const sexpr::range& e);
+static ast::abs transform_abs(const sexpr::range& e);
+static ast::app transform_app(const sexpr::range& e);
+static ast::var transform_var(const sexpr::node& e);
+static ast::var transform_var(const symbol& s);
 
 
 // sequences and conditionals
-static ast::seq transform_seq(const sexpr::list& e);
-static ast::cond transform_cond(const sexpr::list& e);
+static ast::seq transform_seq(const sexpr::range& e);
+static ast::cond transform_cond(const sexpr::range& e);
 
 
 struct match_expr {
@@ -62,7 +66,7 @@ struct match_expr {
 	return ast::lit<bool>{self};
   }
 
-  ast::expr operator()(const std::string& self) const {
+  ast::expr operator()(const sexpr::text& self) const {
 	return ast::lit<std::string>{self};
   }
 
@@ -74,7 +78,7 @@ struct match_expr {
   }
   
   
-  ast::expr operator()(const sexpr::list& self) const {
+  ast::expr operator()(const sexpr::range& self) const {
 
 	if( self.empty() ) {
 	  return ast::lit<void>();
@@ -82,7 +86,7 @@ struct match_expr {
 
 	// handle special forms
 	if( self[0].is<symbol>() ) {
-	  auto& s = self[0].as<symbol>();
+	  const symbol s = self[0].as<symbol>();
 	  
 	  if( s == keyword.let ) {
 		return transform_let(self);
@@ -113,14 +117,17 @@ struct match_expr {
 };
 
 
-static ast::app transform_app(const sexpr::list& self) {
+static ast::app transform_app(const sexpr::range& self) {
 
   // function application
   vec<ast::expr> terms;
 
   // transform each expr
-  std::transform(self.begin(), self.end(),
-				 std::back_inserter(terms), transform_expr);
+  terms.reserve( self.size() );
+  
+  for(const sexpr::node& e : self) {
+	terms.push_back( transform_expr(e) );
+  }
 	
   // first must be a lambda or a variable
   if( terms[0].is<ast::abs>() || terms[0].is<ast::var>() || terms[0].is<ast::app>() ) {
@@ -134,7 +141,7 @@ static ast::app transform_app(const sexpr::list& self) {
 }
 
 
-static ast::let transform_let(const sexpr::list& e) {
+static ast::let transform_let(const sexpr::range& e) {
 
   assert(!e.empty() && e[0] == keyword.let );
   
@@ -156,7 +163,7 @@ static ast::let transform_let(const sexpr::list& e) {
 }
 
 
-static ast::abs transform_abs(const sexpr::list& e) {
+static ast::abs transform_abs(const sexpr::range& e) {
   assert(!e.empty() && e[0] == keyword.abs );
   
   if( e.size() != 3 ) {
@@ -166,13 +173,13 @@ static ast::abs transform_abs(const sexpr::list& e) {
   // args check
   if( !e[1].is<sexpr::list>() ) throw syntax_error("argument list expected");
 
-  const sexpr::list& args = e[1].as<sexpr::list>();
+  const sexpr::range args = e[1].as<sexpr::list>();
   
   ast::abs res;
 
   res.args.reserve( args.size() );
   
-  for(const auto& a : args ) {
+  for(const sexpr::node& a : args ) {
 	if( !a.is<symbol>() ) throw syntax_error("arguments must be symbols");
 	
 	res.args.push_back( {a.as<symbol>().name() } );
@@ -186,7 +193,7 @@ static ast::abs transform_abs(const sexpr::list& e) {
 
 
 
-static ast::cond transform_cond(const sexpr::list& self) {
+static ast::cond transform_cond(const sexpr::range& self) {
   assert(!self.empty() && self[0] == keyword.cond );
   
   if(self.size() != 4) throw syntax_error("bad 'if' syntax"); 
@@ -196,7 +203,7 @@ static ast::cond transform_cond(const sexpr::list& self) {
 	  shared<ast::expr>(transform_expr(self[3])) };
 }
 
-static ast::seq transform_seq(const sexpr::list& e) {
+static ast::seq transform_seq(const sexpr::range& e) {
   assert(!e.empty() && e[0] == keyword.seq );
   
   ast::seq res;
@@ -205,9 +212,9 @@ static ast::seq transform_seq(const sexpr::list& e) {
 
 	ast::seq::term term;
 	
-	if(it->is<sexpr::list>() ) {
+	if( (*it).is<sexpr::list>() ) {
 
-	  auto& self = it->as<sexpr::list>();
+	  const sexpr::range self = (*it).as<sexpr::list>();
 
 	  // with 
 	  if( !self.empty() && self[0] == keyword.with ) {
@@ -246,12 +253,12 @@ static ast::seq transform_seq(const sexpr::list& e) {
 }
 
 
-static ast::expr transform_expr(const sexpr::expr& e) {
+static ast::expr transform_expr(const sexpr::node& e) {
   return e.apply<ast::expr>( match_expr() );
 }
 
 
-static ast::def transform_def(const sexpr::list& list) {
+static ast::def transform_def(const sexpr::range& list) {
   assert( !list.empty() && list[0] == keyword.def );
   
   if( list.size() != 3 ) {
@@ -267,13 +274,16 @@ static ast::def transform_def(const sexpr::list& list) {
 }
 
 
-static ast::var transform_var(const sexpr::expr& e) {
+static ast::var transform_var(const sexpr::node& e) {
   if( !e.is<symbol>() ) {
 	throw syntax_error("variable name must be a symbol");
   }
 
-  auto& s = e.as<symbol>();
-  
+  return transform_var( e.as<symbol>() );
+}
+
+
+static ast::var transform_var(const symbol& s) {
   auto it = keyword.all.find( s.name() );
   if(it != keyword.all.end() ) {
 	throw syntax_error( std::string(it->name()) + " is a reserved keyword");
@@ -291,7 +301,7 @@ struct transform_constructor {
 	return  { self.name(), {} };
   }
 
-  ast::type::constructor operator()(const sexpr::list& self) const {
+  ast::type::constructor operator()(const sexpr::range& self) const {
 
 	if(self.size() < 2 || !self[0].is<symbol>() )  {
 	  throw syntax_error("type constructor syntax");
@@ -320,7 +330,7 @@ struct transform_constructor {
 
 
 // data
-static ast::type transform_type(const sexpr::list& list) {
+static ast::type transform_type(const sexpr::range& list) {
   assert( !list.empty() && list[0] == keyword.type);
 
   // TODO split declaration/definition
@@ -333,7 +343,7 @@ static ast::type transform_type(const sexpr::list& list) {
   if( list[1].is<symbol>() ) {
 	res.id = list[1].as<symbol>();
   } else if( list[1].is<sexpr::list>() ) {
-	auto& self = list[1].as<sexpr::list>();
+	const sexpr::range self = list[1].as<sexpr::list>();
 
 	if( self.size() < 2 ) {
 	  throw syntax_error("parametrized datatype syntax");
@@ -386,14 +396,14 @@ ast::expr ast::cond::app() const {
 
 
 // toplevel
-ast::node transform(const sexpr::expr& e) {
+ast::node transform(const sexpr::node& e) {
 
   // detect toplevel definitions, types, etc
   if( e.is<sexpr::list>() ) {
-	auto& list = e.as<sexpr::list>();
+	const sexpr::range list = e.as<sexpr::list>();
 	
 	if( !list.empty() && list[0].is<symbol>() ) {
-	  auto& s = list[0].as<symbol>();
+	  const symbol s = list[0].as<symbol>();
 
 	  if( s == keyword.def ) {
 		return transform_def(list);
@@ -409,3 +419,4 @@ ast::node transform(const sexpr::expr& e) {
   // default: expressions
   return transform_expr(e);
 }
+
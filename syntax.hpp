@@ -12,6 +12,6 @@ struct syntax_error : std::runtime_error {
 
 
 // transform toplevel sexpr into ast
-ast::node transform(const sexpr::expr& e);
+ast::node transform(const sexpr::node& e);
 
 #endif
@@ -0,0 +1,24 @@
+#!/bin/sh
+# compare tree-walking eval and bytecode vm output on lisp tests
+# usage: test/diff.sh [path/to/hm]
+
+hm=${1:-./hm}
+status=0
+
+a=$(mktemp) || exit 1
+b=$(mktemp) || exit 1
+trap 'rm -f "$a" "$b"' EXIT
+
+for f in test/*.lisp; do
+	"$hm" --lisp "$f" > "$a" 2>&1
+	"$hm" --vm "$f" > "$b" 2>&1
+	if cmp -s "$a" "$b"; then
+		echo "ok   $f"
+	else
+		echo "FAIL $f"
+		diff "$a" "$b"
+		status=1
+	fi
+done
+
+exit $status
@@ -0,0 +1,40 @@
+;; typeclass methods are cached on the type of their first argument
+
+(def sum (lambda (x n acc)
+		   (cond ((number=? n 0) acc)
+				 ('else (sum x (number-sub n 1) (+ acc x))))))
+
+(sum 2 1000 0)
+(sum 0.5 1000 0.0)
+
+;; more types than the inline cache holds
+(+ "foo" "bar")
+(+ 'foo 'bar)
+(+ '(1 2) '(3))
+(+ 1 2)
+(+ "foo" "baz")
+(+ '(4) '(5))
+
+;; new instances invalidate caches
+(class Size a (size a))
+(instance Size list (size list-length))
+(size '(1 2 3))
+(instance Size string (size (lambda (x) 'some)))
+(size "foo")
+(size '(1 2))
+(dispatch-stats)
+
+;; writes to other objects leave caches alone
+(def point (object 'point))
+(def touch (lambda (n)
+			 (cond ((number=? n 0) (size '(1)))
+				   ('else (do (object-make-attr! point 'x n)
+							  (size '(1))
+							  (touch (number-sub n 1)))))))
+(touch 100)
+(dispatch-stats)
+
+;; writes to an instance refresh its cache entry
+(object-make-attr! (object-attr Size 'list) 'size (lambda (x) 'changed))
+(size '(1 2))
+(dispatch-stats)
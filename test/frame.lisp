@@ -0,0 +1,37 @@
+;; frames that cannot escape are reused across calls
+
+;; non-tail recursion
+(def sum (lambda (n)
+		   (cond ((number=? n 0) 0)
+				 ('else (number-add n (sum (number-sub n 1)))))))
+
+(sum 2000)
+
+;; arguments and definitions in reused frames
+(def norm (lambda (x y)
+			(do
+			  (def xx (number-mul x x))
+			  (def yy (number-mul y y))
+			  (number-add xx yy))))
+
+(norm 3 4)
+(norm 5 12)
+
+(def rest (lambda (x . xs) (cons x xs)))
+(rest 1 2 3)
+(rest 4)
+
+;; closures keep their frame
+(def adder (lambda (n) (lambda (x) (number-add x n))))
+(def add2 (adder 2))
+(def add5 (adder 5))
+(norm 1 1)
+(add2 1)
+(add5 1)
+
+;; frames referenced after the call returns
+(def frames (lambda (n acc)
+			  (cond ((number=? n 0) acc)
+					('else (frames (number-sub n 1) (cons (adder n) acc))))))
+
+(list-map (frames 3 '()) (lambda (f) (f 10)))
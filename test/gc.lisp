@@ -0,0 +1,25 @@
+;; closures defined in their own frame form cycles, left to the collector
+
+(def make-counter (lambda (n)
+					(do
+					 (def next (lambda () (do (set! n (number-add n 1)) n)))
+					 next)))
+
+(def churn (lambda (i)
+			 (cond ((number=? i 0) 'done)
+				   ('else (do ((make-counter i)) (churn (number-sub i 1)))))))
+
+(def counter (make-counter 0))
+
+(def collected (lambda () (nth (nth (gc-stats) 2) 1)))
+(def before (collected))
+
+(churn 100000)
+(do (gc) 'collected)
+
+;; every churned counter is a cycle
+(number<? 99999 (number-sub (collected) before))
+
+(counter)
+(counter)
+(list? (gc-stats))
@@ -5,3 +5,36 @@
 
 
 
+(def y '(1 2 3 4 5 6 7 8))
+(list-length y)
+(nth y 6)
+(nth (cdr (cdr y)) 3)
+(nth (cons 0 y) 8)
+(list-length ((lambda args args) 'a 'b 'c))
+
+(defn inc (x) (+ x 1))
+(defn odd? (x) (not (= (number-sub x (number-mul 2 (number-div x 2))) 0)))
+
+(list-map y inc)
+(list-filter y odd?)
+(list-fold y 0 +)
+(list-append '(a b) '(c d))
+(list-reverse y)
+(list-each '(1 2) echo)
+
+;; single pass over y
+(list-fold (list-filter (list-map y inc) odd?) 0 +)
+(list-map (list-map (list-filter y odd?) inc) (fn (x) (list x)))
+
+;; pure stages are interleaved, others keep their eager order
+(defn big? (x) (number<? 4 x))
+(list-fold (list-filter (list-map y (fn (x) (number-mul x x))) big?) 0 number-add)
+(list-filter (list-map y (fn (x) (do (echo 'map x) x))) (fn (x) (do (echo 'filter x) (odd? x))))
+
+;; stage arguments with side effects come after earlier stages
+(list-filter (list-map '(1 2) (fn (x) (do (echo 'map x) x))) (do (echo 'filter-arg) odd?))
+
+;; stages one after the other
+(def map1 list-map)
+(list-fold (list-filter (map1 y inc) odd?) 0 +)
+((fn (list-map) (list-filter (list-map y 0) odd?)) (fn (x f) '(1 2 3)))
@@ -0,0 +1,8 @@
+;; integers wrap around
+(number-add 2147483647 1)
+(number-sub -2147483648 1)
+(number-mul 65536 65536)
+(number-mul 123456789 1000)
+(number-div -2147483648 -1)
+(number-div 7 -2)
+(number-add 1 2.5)
@@ -0,0 +1,26 @@
+;; objects built alike share their shape
+
+(def point (lambda (x y)
+			 (do
+			  (def self (object 'point))
+			  (object-make-attr! self 'x x)
+			  (object-make-attr! self 'y y)
+			  self)))
+
+(def p (point 1 2))
+(def q (point 3 4))
+
+(object-attr p 'x)
+(object-attr q 'y)
+
+(object-make-attr! p 'x 10)
+(object-attr p 'x)
+(object-attr q 'x)
+
+;; same attributes in another order
+(def r (object 'point))
+(object-make-attr! r 'y 5)
+(object-make-attr! r 'x 6)
+(object-attr r 'x)
+(object-attr r 'y)
+(type r)
@@ -0,0 +1,14 @@
+;; call counts and timings are reported per lambda
+
+(def count (lambda (n)
+			 (cond ((number=? n 0) 'done)
+				   ('else (count (number-sub n 1))))))
+
+(profile-start)
+(count 1000)
+(list? (profile-stop))
+
+;; sampling
+(profile-start 1)
+(count 10000)
+(list? (profile-stop))
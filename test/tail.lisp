@@ -0,0 +1,25 @@
+;; calls in tail position run in constant stack
+
+(def count (lambda (n acc)
+			 (cond ((number=? n 0) acc)
+				   ('else (count (number-sub n 1) (number-add acc 1))))))
+
+(count 1000000 0)
+
+
+;; through macros and sequences
+(def even? (lambda (n) (if (number=? n 0) true (do 'odd (odd? (number-sub n 1))))))
+(def odd? (lambda (n) (if (number=? n 0) false (even? (number-sub n 1)))))
+
+(even? 1000000)
+
+
+;; long lists
+(def iota (lambda (n acc)
+			(cond ((number=? n 0) acc)
+				  ('else (iota (number-sub n 1) (cons n acc))))))
+
+(def big (iota 1000000 '()))
+
+(list-length big)
+(nth big 999999)
@@ -0,0 +1,70 @@
+#include "thread_pool.hpp"
+
+
+thread_pool::thread_pool(unsigned n) {
+  for(unsigned i = 1; i < n; ++i) {
+	workers.emplace_back( [this] { loop(); } );
+  }
+}
+
+
+thread_pool::~thread_pool() {
+  {
+	std::lock_guard<std::mutex> lock(mutex);
+	stop = true;
+  }
+  
+  wake.notify_all();
+  
+  for(auto& w : workers) {
+	w.join();
+  }
+}
+
+
+void thread_pool::loop() {
+  unsigned seen = 0;
+  
+  std::unique_lock<std::mutex> lock(mutex);
+  
+  while( true ) {
+	wake.wait(lock, [&] { return stop || generation != seen; });
+	if( stop ) return;
+
+	seen = generation;
+	work(lock);
+  }
+}
+
+
+// grab tasks from current batch until exhausted, lock is held on
+// entry/exit
+void thread_pool::work(std::unique_lock<std::mutex>& lock) {
+  while( next < size ) {
+	const std::size_t i = next++;
+	
+	lock.unlock();
+	task(i);
+	lock.lock();
+	
+	if( --pending == 0 ) done.notify_all();
+  }
+}
+
+
+void thread_pool::run(std::size_t n, const std::function<void(std::size_t)>& f) {
+  if( !n ) return;
+  
+  std::unique_lock<std::mutex> lock(mutex);
+
+  task = f;
+  next = 0;
+  size = n;
+  pending = n;
+  ++generation;
+  
+  wake.notify_all();
+  work(lock);
+  
+  done.wait(lock, [&] { return pending == 0; });
+}
@@ -0,0 +1,43 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "common.hpp"
+
+// fixed set of worker threads running batches of tasks
+class thread_pool {
+  vec<std::thread> workers;
+  
+  std::mutex mutex;
+  std::condition_variable wake, done;
+
+  // current batch
+  std::function<void(std::size_t)> task;
+  std::size_t next = 0, size = 0, pending = 0;
+  unsigned generation = 0;
+  
+  bool stop = false;
+
+  void loop();
+  void work(std::unique_lock<std::mutex>& lock);
+  
+public:
+
+  // the calling thread also works during run, so n - 1 threads are
+  // spawned
+  thread_pool(unsigned n = std::thread::hardware_concurrency());
+  ~thread_pool();
+
+  // call task(i) for i in [0, n) and wait for completion. tasks must not
+  // throw.
+  void run(std::size_t n, const std::function<void(std::size_t)>& task);
+
+  unsigned threads() const { return workers.size() + 1; }
+};
+
+
+#endif
@@ -0,0 +1,195 @@
+#include "toplevel.hpp"
+
+#include "hindley_milner.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+
+std::set<ast::var> dependencies(const ast::def& self) {
+  // (def x y) is typechecked as (let x y x)
+  const ast::expr tmp = ast::let{self.id, self.value, shared<ast::expr>(self.id)};
+  return ast::free(tmp);
+}
+
+
+void toplevel::reload() {
+  dirty.clear();
+}
+
+
+const type::poly* toplevel::find(const ast::var& id, const sexpr::node& source) const {
+  auto it = table.find(id);
+  if( it == table.end() ) return nullptr;
+
+  const entry& self = it->second;
+  if( source != self.source ) return nullptr;
+
+  for(const auto& d : self.deps) {
+	if( dirty.find(d) != dirty.end() ) return nullptr;
+  }
+
+  return &self.type;
+}
+
+
+void toplevel::update(const ast::def& self, const sexpr::node& source, const type::poly& p) {
+  table[self.id] = {sexpr::copy(source), dependencies(self), p};
+  dirty.insert(self.id);
+}
+
+
+vec<toplevel::result> toplevel::infer(const sexpr::node* source, const ast::node* node, std::size_t n,
+									  context& ctx, union_find<type::mono>& types,
+									  thread_pool& pool) {
+  struct task {
+	std::size_t index;
+	std::set<ast::var> deps;
+	const type::poly* cached;
+  };
+  
+  // schedule forms in waves
+  vec< vec<task> > waves;
+  vec<bool> cached(n);
+  {
+	// wave of latest definition for each name
+	std::map<ast::var, std::size_t> defined;
+
+	// last wave using current definition for each name
+	std::map<ast::var, std::size_t> used;
+	
+	for(std::size_t i = 0; i < n; ++i) {
+	  task t = {i, {}, nullptr};
+	  
+	  if( node[i].is<ast::def>() ) {
+		auto& self = node[i].as<ast::def>();
+		t.deps = dependencies(self);
+		
+		// unchanged definitions don't need inference
+		t.cached = find(self.id, source[i]);
+		if( !t.cached ) dirty.insert(self.id);
+		cached[i] = t.cached;
+		
+	  } else {
+		t.deps = ast::free(node[i].as<ast::expr>());
+	  }
+	  
+	  std::size_t wave = 0;
+	  
+	  for(const auto& d : t.deps) {
+		auto it = defined.find(d);
+		if( it != defined.end() ) wave = std::max(wave, it->second + 1);
+	  }
+
+	  if( node[i].is<ast::def>() ) {
+		auto& id = node[i].as<ast::def>().id;
+
+		// redefinitions come after the previous definition and its users
+		auto it = defined.find(id);
+		if( it != defined.end() ) wave = std::max(wave, it->second + 1);
+
+		it = used.find(id);
+		if( it != used.end() ) wave = std::max(wave, it->second + 1);
+	  }
+	  
+	  for(const auto& d : t.deps) {
+		std::size_t& u = used[d];
+		u = std::max(u, wave);
+	  }
+
+	  if( node[i].is<ast::def>() ) {
+		auto& id = node[i].as<ast::def>().id;
+		defined[id] = wave;
+		used.erase(id);
+	  }
+
+	  if( waves.size() <= wave ) waves.resize(wave + 1);
+	  waves[wave].push_back( std::move(t) );
+	}
+  }
+
+  vec<result> res(n);
+  std::size_t first_error = n;
+
+  // later waves see definitions from earlier ones, which may come after
+  // the first error in program order: ctx only gets the error-free prefix
+  context scratch(&ctx);
+  
+  auto run = [&](const task& t, union_find<type::mono>& types) {
+	try {
+	  if( t.cached ) {
+		res[t.index].type = *t.cached;
+	  } else if( node[t.index].is<ast::def>() ) {
+		auto& self = node[t.index].as<ast::def>();
+		const ast::let tmp = {self.id, self.value, shared<ast::expr>(self.id)};
+		res[t.index].type = hindley_milner(types, scratch, tmp);
+	  } else {
+		res[t.index].type = hindley_milner(types, scratch, node[t.index].as<ast::expr>());
+	  }
+	} catch( ... ) {
+	  res[t.index].error = std::current_exception();
+	}
+  };
+  
+  for(const auto& wave : waves) {
+	
+	// forms seeing free type variables must share their unification
+	vec<const task*> shared, independent;
+	
+	for(const auto& t : wave) {
+	  if( t.index >= first_error ) continue;
+	  
+	  const bool open = std::any_of(t.deps.begin(), t.deps.end(), [&](const ast::var& d) {
+		  try {
+			return !closed( scratch.find(d) );
+		  } catch( type_error& ) {
+			// unbound: will fail during inference
+			return false;
+		  }
+		});
+
+	  (open ? shared : independent).push_back(&t);
+	}
+
+	pool.run(independent.size(), [&](std::size_t i) {
+		union_find<type::mono> local;
+		run(*independent[i], local);
+	  });
+
+	for(const task* t : shared) {
+	  run(*t, types);
+	}
+
+	// definitions for the next waves, in program order (waves are sorted)
+	for(const auto& t : wave) {
+	  const std::size_t i = t.index;
+	  if( i >= first_error ) break;
+	  
+	  if( res[i].error ) {
+		first_error = i;
+		break;
+	  }
+	  
+	  if( node[i].is<ast::def>() ) {
+		scratch.set(node[i].as<ast::def>().id, res[i].type);
+	  }
+	}
+  }
+
+  // commit forms before the first error, as sequential inference would
+  for(std::size_t i = 0; i < first_error; ++i) {
+	if( !node[i].is<ast::def>() ) continue;
+	
+	auto& self = node[i].as<ast::def>();
+	ctx.set(self.id, res[i].type);
+	
+	if( !cached[i] ) update(self, source[i], res[i].type);
+  }
+
+  // later forms are left uninferred
+  for(std::size_t i = first_error + 1; i < n; ++i) {
+	res[i] = result();
+  }
+  
+  return res;
+}
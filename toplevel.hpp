@@ -0,0 +1,68 @@
+#ifndef TOPLEVEL_HPP
+#define TOPLEVEL_HPP
+
+#include "ast.hpp"
+#include "sexpr.hpp"
+#include "type.hpp"
+#include "union_find.hpp"
+
+#include <map>
+#include <set>
+#include <exception>
+
+class context;
+class thread_pool;
+
+// cache of inferred types for toplevel definitions, so that reloading
+// a program only re-infers changed definitions and their dependents
+class toplevel {
+  
+  struct entry {
+	sexpr::expr source;
+	std::set<ast::var> deps;
+	type::poly type;
+  };
+
+  std::map<ast::var, entry> table;
+
+  // definitions re-inferred during current pass
+  std::set<ast::var> dirty;
+  
+public:
+
+  // start a new pass over a program
+  void reload();
+  
+  // cached type for definition, if source is unchanged and no
+  // dependency was re-inferred during this pass. nullptr otherwise.
+  const type::poly* find(const ast::var& id, const sexpr::node& source) const;
+
+  // record a (re-)inferred definition
+  void update(const ast::def& self, const sexpr::node& source, const type::poly& p);
+
+  
+  // inferred type for a toplevel form, or the error it raised
+  struct result {
+	type::poly type;
+	std::exception_ptr error;
+  };
+  
+  // concurrent inference for toplevel definitions/expressions in
+  // [node, node + n) with their sources. forms are scheduled in waves
+  // so that a form only sees definitions from previous waves, each wave
+  // runs on pool with one union_find per form. forms depending on free
+  // type variables (value restriction) use the shared types instead.
+  //
+  // definitions are added to ctx in program order. forms after the
+  // first error (in program order) are left uninferred.
+  vec<result> infer(const sexpr::node* source, const ast::node* node, std::size_t n,
+					context& ctx, union_find<type::mono>& types, thread_pool& pool);
+  
+};
+
+
+// variables a toplevel definition depends on
+std::set<ast::var> dependencies(const ast::def& self);
+
+
+#endif
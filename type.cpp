@@ -2,28 +2,141 @@
 
 #include <ostream>
 #include <map>
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <cstdint>
 
 namespace type {
 
   
-  unsigned var::total = 0;
+  std::atomic<unsigned> var::total(0);
 
-  // bool app::operator<(const app& other) const {
-  // 	return  (*from < *other.from) || ((*from == *other.from) && (*to < *other.to));
-  // }
+  // hash-consing table for type applications: nodes live in deques
+  // (stable addresses, chunked allocation) and are indexed by
+  // open-addressing hash tables. the table is split in stripes by hash,
+  // each with its own lock, so that inference threads seldom contend
+  namespace {
 
+	struct hash_mono {
+	  
+	  std::size_t operator()(const app& self) const {
+		return self->id * 3;
+	  }
+
+	  std::size_t operator()(const var& self) const {
+		return self.index * 3 + 1;
+	  }
+
+	  std::size_t operator()(const lit& self) const {
+		return std::hash<const char*>()(self.name()) * 3 + 2;
+	  }
+	  
+	};
+
+
+	static std::size_t hash(const abs& func, const mono* first, const mono* last) {
+	  std::size_t res = std::hash<const char*>()(func.name());
+	  for(const mono* it = first; it != last; ++it) {
+		res = res * 31 + it->apply<std::size_t>(hash_mono());
+	  }
+	  return res;
+	}
+	
+	
+	class stripe_type {
+	  std::mutex mutex;
+	  std::deque<app_type> arena;
+	  vec<const app_type*> buckets;
+	  
+	  static bool equal(const app_type* node, const abs& func,
+						const mono* first, const mono* last) {
+		if( node->func != func ) return false;
+		return std::equal(first, last, node->args.begin());
+	  }
+	  
+	  // double capacity and reinsert nodes
+	  void grow() {
+		vec<const app_type*> old(std::max<std::size_t>(64, 2 * buckets.size()), nullptr);
+		old.swap(buckets);
+
+		for(const app_type& node : arena) {
+		  const mono* first = node.args.data();
+		  slot( hash(node.func, first, first + node.args.size()) ) = &node;
+		}
+	  }
+
+	  // first empty bucket for hash h
+	  const app_type*& slot(std::size_t h) {
+		const std::size_t mask = buckets.size() - 1;
+		for(std::size_t i = h & mask; ; i = (i + 1) & mask) {
+		  if( !buckets[i] ) return buckets[i];
+		}
+	  }
+	  
+	public:
+
+	  // new nodes get ids index, index + stride, ...
+	  const app_type* intern(std::size_t h, std::size_t index, std::size_t stride,
+							 const abs& func, const mono* first, const mono* last) {
+		std::lock_guard<std::mutex> lock(mutex);
+		
+		if( 2 * (arena.size() + 1) > buckets.size() ) grow();
+		
+		const std::size_t mask = buckets.size() - 1;
+
+		std::size_t i = h & mask;
+		for(; buckets[i]; i = (i + 1) & mask) {
+		  if( equal(buckets[i], func, first, last) ) return buckets[i];
+		}
+
+		arena.push_back( {func, vec<mono>(first, last), arena.size() * stride + index} );
+		return buckets[i] = &arena.back();
+	  }
+	  
+	};
+
+
+	class table_type {
+	  static constexpr std::size_t size = 64;
+	  stripe_type stripes[size];
+	  
+	public:
 
-  // bool app::operator==(const app& other) const {
-  // 	return  (*from == *other.from) && (*to == *other.to);
-  // }
+	  const app_type* intern(const abs& func, const mono* first, const mono* last) {
+		
+		if( func.arity() != std::size_t(last - first) ) {
+		  throw std::runtime_error("arity error for " + std::string(func.name()));
+		}
 
-  app_type::app_type(const abs& func,
-					 const vec<mono>& args)
-	: func(func),
-	  args(args) {
-	if( func.arity() != args.size() ) {
-	  throw std::runtime_error("arity error for " + std::string(func.name()));
+		const std::size_t h = hash(func, first, last);
+
+		// stripes use the high bits of the mixed hash, buckets the low ones
+		const std::size_t index = ((std::uint64_t(h) * 0x9e3779b97f4a7c15ull) >> 58) % size;
+		return stripes[index].intern(h, index, size, func, first, last);
+	  }
+	  
+	};
+
+	
+	static table_type& table() {
+	  static table_type instance;
+	  return instance;
 	}
+	
+  }
+
+  
+  app::app(const abs& func, const mono* first, const mono* last)
+	: node( table().intern(func, first, last) ) { }
+  
+  app::app(const abs& func, const vec<mono>& args)
+	: app(func, args.data(), args.data() + args.size()) { }
+
+  // node ids: a strict order, though not a deterministic one with
+  // several inference threads
+  bool app::operator<(const app& other) const {
+	return node->id < other.node->id;
   }
 
   
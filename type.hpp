@@ -5,6 +5,7 @@
 #include "variant.hpp"
 
 #include <ostream>
+#include <atomic>
 
 // type-checking
 namespace type {
@@ -16,16 +17,36 @@ namespace type {
   
   struct var;
 
+  struct abs;
   struct app_type;
-  using app = ref<app_type>;
+  class app;
   
   using mono = variant< app, var, lit >;
+
+  // type applications are hash-consed: an app is a handle to an
+  // interned app_type node, structurally equal applications share the
+  // same node and compare in O(1)
+  class app {
+	const app_type* node;
+  public:
+	// intern application (arity check)
+	app(const abs& func, const mono* first, const mono* last);
+	app(const abs& func, const vec<mono>& args);
+	
+	const app_type* operator->() const { return node; }
+	const app_type& operator*() const { return *node; }
+
+	inline bool operator==(const app& other) const { return node == other.node; }
+	inline bool operator!=(const app& other) const { return node != other.node; }
+	bool operator<(const app& other) const;
+  };
   
   struct var {
 	var(unsigned index = total++) : index(index) { }
 	unsigned index;
 	
-	static unsigned total;
+	// shared by concurrent inference tasks
+	static std::atomic<unsigned> total;
 
 	inline bool operator<(const var& other) const { return index < other.index; }
 	inline bool operator==(const var& other) const { return index == other.index; }
@@ -47,18 +68,13 @@ namespace type {
   };
 
   
-  // type application
+  // type application (interned, see app)
   struct app_type {
-
-	// arity check TODO move args
-	app_type(const abs& func,
-			 const vec<mono>& args);
-	
 	abs func;
 	vec<mono> args;
-	
-	bool operator<(const app& other) const;
-	bool operator==(const app& other) const;
+
+	// unique in type table
+	std::size_t id;
   };
 
   std::ostream& operator<<(std::ostream& out, const mono& p);  
@@ -142,16 +158,15 @@ namespace type {
 
   // easy function types (right-associative)
   static inline app operator>>=(const mono& lhs, const mono& rhs) {
-	app_type res = { func, {lhs, rhs} };
-	return shared<app_type>( std::move(res) );
+	const mono args[] = {lhs, rhs};
+	return app(func, args, args + 2);
   }
 
 
   template<class ... Args>
   app abs::operator()(Args&& ... args) const {
-    vec<type::mono> unpack = {args...};
-    auto res = shared<app_type>(*this, unpack);
-    return res;
+    const vec<type::mono> unpack = {args...};
+    return app(*this, unpack);
   }
 }
 
@@ -6,6 +6,8 @@
 
 #include <iostream>
 
+#include "type.hpp"
+
 template<class T>
 struct union_find {
   using rank_type =  std::map<T, int>;
@@ -88,4 +90,159 @@ public:
 
 
 
+// union-find specialized for type inference: only type variables are
+// ever linked, so parents/ranks live in arrays indexed by
+// type::var::index. each class root holds an explicit payload: the
+// nice representative returned by find (a type variable or a
+// constructed type), empty for singletons.
+//
+// roots also carry the let-depth (level) of their class for didier
+// remy's efficient generalization: variables deeper than the current
+// depth are not referenced by the enclosing context.
+template<>
+struct union_find<type::mono> {
+  
+  // variables are tracked in slots from index base on: union-finds
+  // created late (e.g. one per inference task) stay small
+  unsigned base = type::var::total;
+  
+  vec<unsigned> parent;
+  vec<unsigned char> rank;
+  vec<type::mono> payload;
+  vec<unsigned> levels;
+
+  // current let-depth
+  unsigned depth = 0;
+
+private:
+
+  // slot for variable index i, tracked if needed
+  unsigned slot(unsigned i) {
+	if( i < base ) rebase(i);
+
+	const unsigned k = i - base;
+	if( k >= parent.size() ) reserve(k);
+	
+	return k;
+  }
+  
+  void reserve(unsigned k) {
+	const unsigned old = parent.size();
+	const unsigned size = std::max(k + 1, 2 * old);
+	
+	parent.resize(size);
+	rank.resize(size, 0);
+	payload.resize(size);
+	levels.resize(size, 0);
+
+	for(unsigned j = old; j < size; ++j) parent[j] = j;
+  }
+
+  // track variables from index i on (rare)
+  void rebase(unsigned i) {
+	const unsigned shift = base - i;
+	
+	for(unsigned& p : parent) p += shift;
+	
+	parent.insert(parent.begin(), shift, 0);
+	rank.insert(rank.begin(), shift, 0);
+	payload.insert(payload.begin(), shift, type::mono());
+	levels.insert(levels.begin(), shift, 0);
+
+	for(unsigned j = 0; j < shift; ++j) parent[j] = j;
+	base = i;
+  }
+  
+  // class root slot with path halving
+  unsigned root(unsigned i) {
+	unsigned k = slot(i);
+
+	while( parent[k] != k ) {
+	  parent[k] = parent[ parent[k] ];
+	  k = parent[k];
+	}
+	
+	return k;
+  }
+  
+public:
+
+  // fresh type variable at current depth
+  type::var fresh() {
+	type::var res;
+	levels[ slot(res.index) ] = depth;
+	return res;
+  }
+
+  // level of the class of x (variables unknown so far are at depth 0)
+  unsigned level(const type::var& x) {
+	return levels[ root(x.index) ];
+  }
+
+  void set_level(const type::var& x, unsigned lvl) {
+	levels[ root(x.index) ] = lvl;
+  }
+  
+  // y becomes representative
+  void link(const type::var& x, const type::mono& y) {
+	unsigned rx = root(x.index);
+
+	if( y.is<type::var>() ) {
+	  unsigned ry = root(y.as<type::var>().index);
+
+	  if( rx != ry ) {
+		const unsigned lvl = std::min(levels[rx], levels[ry]);
+		
+		// union by rank
+		if( rank[rx] < rank[ry] ) std::swap(rx, ry);
+		else if( rank[rx] == rank[ry] ) ++rank[rx];
+		
+		parent[ry] = rx;
+		payload[ry] = {};
+		levels[rx] = lvl;
+	  }
+	}
+	
+	payload[rx] = y;
+  }
+
+  // find representative for type
+  type::mono find(const type::mono& x) {
+	if( !x.is<type::var>() ) return x;
+
+	const unsigned r = root(x.as<type::var>().index);
+	
+	const type::mono& res = payload[r];
+	if( res ) return res;
+	
+	return type::var(base + r);
+  }
+  
+
+  friend std::ostream& operator<<(std::ostream& out, union_find& self) {
+	std::map<type::mono, vec<type::mono> > classes;
+
+	for(unsigned i = 0, n = self.parent.size(); i < n; ++i) {
+	  if( self.parent[i] == i && !self.payload[i] ) continue;
+
+	  const type::var x(self.base + i);
+	  classes[ self.find(x) ].push_back(x);
+	}
+
+	for(const auto& c : classes ) {
+	  out << c.first;
+      
+	  for(const auto& x : c.second) {
+		if( x != c.first) out << ", " << x;
+	  }
+
+	  out << '\n';
+	}
+	
+	return out;
+  }
+  
+};
+
+
 #endif
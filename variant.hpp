@@ -204,7 +204,7 @@ public:
 	apply( construct(), other);
   }
 
-  variant(variant&& other) : id(other.id) {
+  variant(variant&& other) noexcept : id(other.id) {
 	if( !*this ) return;
 
 	apply( construct(), std::move(other));
@@ -0,0 +1,583 @@
+#include "vm.hpp"
+
+#include <sstream>
+#include <algorithm>
+#include <cstdint>
+
+namespace lisp {
+
+  namespace vm {
+
+	static struct keywords {
+	  symbol define, lambda, fn, quote, begin, cond, set, defmacro, dot;
+
+	  keywords() {
+		symbol::intern({{&define, "def"}, {&lambda, "lambda"}, {&fn, "fn"},
+						{&quote, "quote"}, {&begin, "do"}, {&cond, "cond"},
+						{&set, "set!"}, {&defmacro, "defmacro"}, {&dot, "."}});
+	  }
+	} keyword;
+
+
+	enum opcode : std::uint8_t {
+	  CONST,					// push constant
+	  LOCAL,					// push frame variable
+	  GLOBAL,					// push global variable
+	  SET_LOCAL,				// pop into frame variable
+	  SET_GLOBAL,				// pop into existing global variable
+	  DEF_GLOBAL,				// pop into global variable
+	  POP,
+	  JUMP,
+	  JUMP_IF_FALSE,			// pop, jump if false
+	  CALL,						// call function below arg count args
+	  TAIL_CALL,				// call, replacing the current activation
+	  RETURN,
+	  CLOSURE,					// push closure for nested function
+	  EVAL,						// evaluate constant with the tree-walker
+	};
+
+
+	struct instr {
+	  opcode op;
+	  std::uint16_t depth;
+	  std::uint32_t arg;
+	};
+
+
+	// global variable, resolved on first use. environment entries are
+	// never erased, so the address stays valid
+	struct global_site {
+	  symbol name;
+	  value* cache;
+	};
+
+
+	struct code_type {
+	  // enclosing function, null at toplevel
+	  const code_type* parent = nullptr;
+
+	  mutable environment global;
+
+	  vec<instr> code;
+	  vec<value> constants;
+	  mutable vec<global_site> globals;
+	  vec< ref<code_type> > functions;
+
+	  // frame layout: arguments, rest argument, local definitions
+	  vec<symbol> names;
+	  unsigned argc = 0;
+	  bool vararg = false;
+	};
+
+
+	// frames are environments with slots only, so that the collector sees
+	// the closures they hold
+	using frame = environment;
+
+
+	// closure data. the closure owns the environment
+	struct function_type {
+	  ref<code_type> code;
+	  environment_type* env;
+	};
+
+	static value call(environment& env, void* data, value* first, value* last);
+
+
+	class compiler {
+	  code_type& self;
+
+	  void emit(opcode op, std::uint32_t arg = 0, std::uint16_t depth = 0) {
+		self.code.push_back( {op, depth, arg} );
+	  }
+
+	  std::uint32_t constant(const value& x) {
+		self.constants.push_back(x);
+		return self.constants.size() - 1;
+	  }
+
+	  std::uint32_t global(symbol name) {
+		self.globals.push_back( {name, nullptr} );
+		return self.globals.size() - 1;
+	  }
+
+	  // lexical address of a frame variable, false for globals
+	  bool resolve(symbol name, std::uint16_t& depth, std::uint32_t& slot) const {
+		depth = 0;
+
+		for(const code_type* c = &self; c->parent; c = c->parent, ++depth) {
+		  auto it = std::find(c->names.begin(), c->names.end(), name);
+		  if( it != c->names.end() ) {
+			slot = it - c->names.begin();
+			return true;
+		  }
+		}
+
+		return false;
+	  }
+
+
+	  void variable(symbol name) {
+		std::uint16_t depth;
+		std::uint32_t slot;
+
+		if( resolve(name, depth, slot) ) emit(LOCAL, slot, depth);
+		else emit(GLOBAL, global(name));
+	  }
+
+
+	  void function(const list& args) {
+		if( length(args) != 2 ) throw error("bad lambda syntax");
+
+		const value& vars = args->head;
+
+		if( !vars.is<list>() && !vars.is<symbol>() ) {
+		  throw error("expected variable list or symbol for lambda arguments");
+		}
+
+		ref<code_type> sub = shared<code_type>();
+		sub->parent = &self;
+		sub->global = self.global;
+
+		if( vars.is<symbol>() ) {
+		  sub->vararg = true;
+		  sub->names.push_back( vars.as<symbol>() );
+		} else {
+		  for(list it = vars.as<list>(); it; it = it->tail) {
+			if( !it->head.is<symbol>() ) throw error("arguments must be symbols");
+			const symbol& s = it->head.as<symbol>();
+
+			if( s == keyword.dot ) {
+			  if( !it->tail || it->tail->tail || !it->tail->head.is<symbol>() ) {
+				throw error("vararg must be the last argument");
+			  }
+
+			  sub->vararg = true;
+			  sub->names.push_back( it->tail->head.as<symbol>() );
+			  break;
+			}
+
+			sub->names.push_back(s);
+			++sub->argc;
+		  }
+		}
+
+		const value& body = args->tail->head;
+		definitions(body, sub->names);
+
+		compiler(*sub).body(body);
+
+		self.functions.push_back(sub);
+		emit(CLOSURE, self.functions.size() - 1);
+	  }
+
+
+	  void define(const list& args) {
+		if( length(args) != 2 ) throw error("bad define syntax");
+
+		if( !args->head.is<symbol>() ) {
+		  throw error("symbol expected for variable name");
+		}
+
+		const symbol& name = args->head.as<symbol>();
+		compile(args->tail->head);
+
+		// local definitions were collected with the frame layout
+		std::uint16_t depth;
+		std::uint32_t slot;
+
+		if( self.parent && resolve(name, depth, slot) ) emit(SET_LOCAL, slot, depth);
+		else emit(DEF_GLOBAL, global(name));
+
+		emit(CONST, constant(null));
+	  }
+
+
+	  void set(const list& args) {
+		if( length(args) != 2 ) throw error("bad set! syntax");
+		if( !args->head.is<symbol>() ) throw error("variable name expected");
+
+		const symbol& name = args->head.as<symbol>();
+		compile(args->tail->head);
+
+		std::uint16_t depth;
+		std::uint32_t slot;
+
+		if( resolve(name, depth, slot) ) emit(SET_LOCAL, slot, depth);
+		else emit(SET_GLOBAL, global(name));
+
+		emit(CONST, constant(null));
+	  }
+
+
+	  void cond(const list& args, bool tail) {
+		vec<std::size_t> exits;
+
+		for(const value& c : args) {
+		  if( !c.is<list>() || length(c.as<list>()) != 2 ) {
+			std::stringstream ss;
+			ss << "condition should be a pair: " << c;
+			throw error(ss.str());
+		  }
+
+		  const list& clause = c.as<list>();
+
+		  compile(clause->head);
+		  const std::size_t test = self.code.size();
+		  emit(JUMP_IF_FALSE);
+
+		  compile(clause->tail->head, tail);
+		  exits.push_back( self.code.size() );
+		  emit(JUMP);
+
+		  self.code[test].arg = self.code.size();
+		}
+
+		emit(CONST, constant(null));
+
+		for(std::size_t i : exits) {
+		  self.code[i].arg = self.code.size();
+		}
+	  }
+
+
+	  void begin(const list& args, bool tail) {
+		if( !args ) return emit(CONST, constant(null));
+
+		for(list it = args; it; it = it->tail) {
+		  compile(it->head, tail && !it->tail);
+		  if( it->tail ) emit(POP);
+		}
+	  }
+
+
+	  void form(const list& e, bool tail) {
+
+		if( e->head.is<symbol>() ) {
+		  const symbol& s = e->head.as<symbol>();
+		  const list& args = e->tail;
+
+		  if( s == keyword.quote ) {
+			if( length(args) != 1 ) throw error("bad quote syntax");
+			return emit(CONST, constant(args->head));
+		  }
+
+		  if( s == keyword.lambda || s == keyword.fn ) return function(args);
+		  if( s == keyword.define ) return define(args);
+		  if( s == keyword.set ) return set(args);
+		  if( s == keyword.cond ) return cond(args, tail);
+		  if( s == keyword.begin ) return begin(args, tail);
+
+		  // macros are defined at run time, and calls that failed to expand
+		  // report their error when reached
+		  if( s == keyword.defmacro || is_macro(s) ) return emit(EVAL, constant(e));
+		}
+
+		// application
+		unsigned argc = 0;
+
+		for(const value& x : e) {
+		  compile(x);
+		  ++argc;
+		}
+
+		emit(tail ? TAIL_CALL : CALL, argc - 1);
+	  }
+
+	public:
+
+	  compiler(code_type& self) : self(self) { }
+
+	  void body(const value& e) {
+		compile(e, true);
+		emit(RETURN);
+	  }
+
+	  void compile(const value& e, bool tail = false) {
+		if( e.is<symbol>() ) return variable( e.as<symbol>() );
+
+		if( e.is<list>() ) {
+		  // the reference interpreter reports empty applications
+		  if( !e.as<list>() ) return emit(EVAL, constant(e));
+		  return form( e.as<list>(), tail );
+		}
+
+		emit(CONST, constant(e));
+	  }
+
+	};
+
+
+
+	class machine {
+
+	  // arguments are passed in place, so the stack never reallocates
+	  static constexpr std::size_t capacity = 1 << 20;
+	  static constexpr std::size_t margin = 1 << 10;
+
+	  vec<value> stack;
+
+	  struct activation {
+		const code_type* code;
+		const instr* pc;
+		frame env;
+		std::size_t base;
+	  };
+
+	  vec<activation> frames;
+
+
+	  static frame make_frame(const function_type& f, value* first, value* last) {
+		const code_type& code = *f.code;
+		const std::size_t argc = last - first;
+
+		if( argc < code.argc || (argc > code.argc && !code.vararg) ) {
+		  error e("bad argument count");
+		  std::stringstream ss;
+		  ss << "expected: " << code.argc << (code.vararg ? "+" : "") << std::endl;
+		  e.details = ss.str();
+		  throw e;
+		}
+
+		// only nested functions capture frames
+		frame res = environment_type::frame(environment(f.env), code.names.size(),
+											!code.functions.empty());
+		std::copy(first, first + code.argc, res->slots.begin());
+
+		if( code.vararg ) {
+		  res->slots[code.argc] = make_list(first + code.argc, last);
+		}
+
+		return res;
+	  }
+
+
+	  [[noreturn]] static void unbound(const code_type* code, const instr& i) {
+		for(unsigned d = 0; d < i.depth; ++d) code = code->parent;
+		throw error("unbound variable: " + std::string(code->names[i.arg].name()));
+	  }
+
+
+	  value run(const code_type* code, frame env, std::size_t base) {
+		const std::size_t depth = frames.size();
+		const instr* pc = code->code.data();
+
+		try {
+		  while( true ) {
+			const instr& i = *pc++;
+
+			switch( i.op ) {
+
+			case CONST:
+			  stack.push_back( code->constants[i.arg] );
+			  break;
+
+			case LOCAL: {
+			  environment_type* f = env.get();
+			  for(unsigned d = 0; d < i.depth; ++d) f = f->outer();
+
+			  const value& x = f->slots[i.arg];
+			  if( !x ) unbound(code, i);
+
+			  stack.push_back(x);
+			  break;
+			}
+
+			case GLOBAL: {
+			  global_site& site = code->globals[i.arg];
+
+			  if( !site.cache ) {
+				site.cache = &code->global->find(site.name, [&] {
+					throw error("unbound variable: " + std::string(site.name.name()));
+				  });
+			  }
+
+			  stack.push_back( *site.cache );
+			  break;
+			}
+
+			case SET_LOCAL: {
+			  environment_type* f = env.get();
+			  for(unsigned d = 0; d < i.depth; ++d) f = f->outer();
+
+			  f->slots[i.arg] = std::move(stack.back());
+			  stack.pop_back();
+			  break;
+			}
+
+			case SET_GLOBAL: {
+			  global_site& site = code->globals[i.arg];
+
+			  if( !site.cache ) {
+				site.cache = &code->global->find(site.name, [&] {
+					throw error("unknown variable " + std::string(site.name.name()));
+				  });
+			  }
+
+			  *site.cache = std::move(stack.back());
+			  stack.pop_back();
+			  ++environment_type::epoch;
+			  break;
+			}
+
+			case DEF_GLOBAL: {
+			  global_site& site = code->globals[i.arg];
+			  site.cache = &(*code->global)[site.name];
+
+			  *site.cache = std::move(stack.back());
+			  stack.pop_back();
+			  break;
+			}
+
+			case POP:
+			  stack.pop_back();
+			  break;
+
+			case JUMP:
+			  pc = code->code.data() + i.arg;
+			  break;
+
+			case JUMP_IF_FALSE: {
+			  // only false is false
+			  const bool fail = stack.back().is<bool>() && !stack.back().as<bool>();
+			  stack.pop_back();
+
+			  if( fail ) pc = code->code.data() + i.arg;
+			  break;
+			}
+
+			case CALL: {
+			  value* args = stack.data() + stack.size() - i.arg;
+			  const value& callee = args[-1];
+
+			  if( callee.is<closure>() && callee.as<closure>()->func == vm::call ) {
+				const function_type& f =
+				  *static_cast<const function_type*>(callee.as<closure>()->data.get());
+
+				if( stack.size() + margin > capacity ) throw error("stack overflow");
+
+				frame sub = make_frame(f, args, args + i.arg);
+				frames.push_back( {code, pc, std::move(env), base} );
+
+				// callee stays on the stack until return
+				code = f.code.get();
+				pc = code->code.data();
+				env = std::move(sub);
+				base = stack.size() - i.arg - 1;
+				break;
+			  }
+
+			  value res = apply(code->global, callee, args, args + i.arg);
+			  stack.resize( stack.size() - i.arg - 1 );
+			  stack.push_back( std::move(res) );
+			  break;
+			}
+
+			case TAIL_CALL: {
+			  value* args = stack.data() + stack.size() - i.arg;
+
+			  if( args[-1].is<closure>() && args[-1].as<closure>()->func == vm::call ) {
+				// the callee owns its code: keep it at the activation base
+				value callee = std::move(args[-1]);
+				const function_type& f =
+				  *static_cast<const function_type*>(callee.as<closure>()->data.get());
+				
+				frame sub = make_frame(f, args, args + i.arg);
+
+				stack.resize(base);
+				stack.push_back( std::move(callee) );
+				
+				code = f.code.get();
+				pc = code->code.data();
+				env = std::move(sub);
+				break;
+			  }
+
+			  value res = apply(code->global, args[-1], args, args + i.arg);
+			  stack.resize( stack.size() - i.arg - 1 );
+			  stack.push_back( std::move(res) );
+			  break;
+			}
+
+			case RETURN: {
+			  value res = std::move(stack.back());
+			  stack.resize(base);
+
+			  if( frames.size() == depth ) return res;
+
+			  activation& caller = frames.back();
+			  code = caller.code;
+			  pc = caller.pc;
+			  env = std::move(caller.env);
+			  base = caller.base;
+			  frames.pop_back();
+
+			  stack.push_back( std::move(res) );
+			  break;
+			}
+
+			case CLOSURE: {
+			  closure res = make<closure_type>();
+			  res->env = env;
+			  res->data = shared<function_type>( function_type{code->functions[i.arg], env.get()} );
+			  res->func = vm::call;
+
+			  stack.push_back( std::move(res) );
+			  break;
+			}
+
+			case EVAL:
+			  stack.push_back( lisp::eval(code->global, code->constants[i.arg]) );
+			  break;
+			}
+		  }
+		} catch( ... ) {
+		  frames.resize(depth);
+		  stack.resize(base);
+		  throw;
+		}
+	  }
+
+	public:
+
+	  machine() { stack.reserve(capacity); }
+
+	  // toplevel code
+	  value exec(const code_type& code) {
+		return run(&code, nullptr, stack.size());
+	  }
+
+	  // closure call from outside the machine
+	  value invoke(const function_type& f, value* first, value* last) {
+		if( stack.size() + margin > capacity ) throw error("stack overflow");
+
+		frame sub = make_frame(f, first, last);
+		return run(f.code.get(), std::move(sub), stack.size());
+	  }
+
+	};
+
+
+	static machine& instance() {
+	  static machine res;
+	  return res;
+	}
+
+
+	static value call(environment&, void* data, value* first, value* last) {
+	  return instance().invoke(*static_cast<const function_type*>(data), first, last);
+	}
+
+
+	value eval(environment& env, const value& expr) {
+	  code_type code;
+	  code.global = env;
+
+	  compiler(code).body( expand(env, expr) );
+
+	  return instance().exec(code);
+	}
+
+  }
+
+}
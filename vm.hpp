@@ -0,0 +1,23 @@
+#ifndef VM_HPP
+#define VM_HPP
+
+#include "lisp.hpp"
+
+namespace lisp {
+
+  // bytecode compiler and stack machine for lisp values. expressions are
+  // macro-expanded once before compilation, variables are resolved to
+  // (depth, slot) addresses in flat frames and globals are looked up by
+  // name once per reference. compiled lambdas are closures, so that they
+  // can be called from eval and builtins.
+  namespace vm {
+
+	// compile expr and run it in the global environment env
+	value eval(environment& env, const value& expr);
+
+  }
+
+}
+
+
+#endif